@@ -0,0 +1,6 @@
+#ifndef APPS_CTXBENCH_H
+#define APPS_CTXBENCH_H
+
+void app_ctxbench(void);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef APPS_FAULTBENCH_H
+#define APPS_FAULTBENCH_H
+
+void app_faultbench(void);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef APPS_FORKBENCH_H
+#define APPS_FORKBENCH_H
+
+void app_forkbench(void);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef APPS_HEAPSTAT_H
+#define APPS_HEAPSTAT_H
+
+void app_heapstat(const char *args);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef APPS_PMMBENCH_H
+#define APPS_PMMBENCH_H
+
+void app_pmmbench(void);
+
+#endif
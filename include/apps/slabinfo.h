@@ -0,0 +1,6 @@
+#ifndef APPS_SLABINFO_H
+#define APPS_SLABINFO_H
+
+void app_slabinfo(void);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef APPS_TLBBENCH_H
+#define APPS_TLBBENCH_H
+
+void app_tlbbench(void);
+
+#endif
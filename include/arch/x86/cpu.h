@@ -0,0 +1,43 @@
+#ifndef ARCH_X86_CPU_H
+#define ARCH_X86_CPU_H
+#include <stdint.h>
+
+static inline uint64_t cpu_rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm__ volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t cpu_read_cr4(void)
+{
+    uint32_t cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void cpu_write_cr4(uint32_t cr4)
+{
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static inline uint32_t cpu_save_irq(void)
+{
+    uint32_t eflags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(eflags) :: "memory");
+    return eflags;
+}
+
+static inline void cpu_restore_irq(uint32_t eflags)
+{
+    if (eflags & 0x200U) {
+        __asm__ volatile ("sti" ::: "memory");
+    }
+}
+
+#endif
@@ -186,6 +186,9 @@ typedef struct {
     uint32_t i:1;        // Interrupt on completion
 } __attribute__((packed)) hba_prdt_entry_t;
 
+// PRDT entries that fit one command table in the per-port DMA block
+#define AHCI_MAX_PRDT 24
+
 // Command Table
 typedef struct {
     uint8_t  cfis[64];   // Command FIS
@@ -221,6 +224,11 @@ int ahci_init(void);
 int ahci_identify(int port, uint16_t *buffer);
 int ahci_read(int port, uint64_t lba, uint16_t count, void *buffer);
 int ahci_write(int port, uint64_t lba, uint16_t count, const void *buffer);
+// Writes count whole pages from a list of physical frames to consecutive
+// sectors from lba, as one command (count <= AHCI_MAX_PRDT).
+int ahci_write_frames(int port, uint64_t lba, const uint32_t *frames, uint32_t count);
+// Reads count whole pages from consecutive sectors into a list of frames.
+int ahci_read_frames(int port, uint64_t lba, const uint32_t *frames, uint32_t count);
 int ahci_get_block_device(int port, block_device_t *dev);
 void ahci_scan_ports(void);
 int ahci_port_is_connected(int port_num);
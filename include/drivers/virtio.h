@@ -78,6 +78,8 @@ typedef struct {
     uint16_t last_used_idx;
     uint16_t free_head;
     uint16_t num_free;
+    uint32_t mem_phys;   // ring memory (physically contiguous PMM block)
+    uint32_t mem_order;
 } virtqueue_t;
 
 // VirtIO Device
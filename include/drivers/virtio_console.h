@@ -14,6 +14,11 @@
  */
 int virtio_console_init(void);
 
+/**
+ * Returns: 1 once the device is initialized, 0 otherwise
+ */
+int virtio_console_available(void);
+
 /**
  * Write a single character to the console
  */
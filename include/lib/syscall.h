@@ -2,6 +2,10 @@
 #define LIB_SYSCALL_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include "sys/syscall_nums.h"
+
+#define MAP_FAILED ((void *)-1)
 
 void exit(void);
 void write(const char *str);
@@ -9,5 +13,12 @@ uint32_t ticks(void);
 void yield(void);
 uint32_t getpid(void);
 int exec(const char *path);
+// Returns the child pid in the parent, 0 in the child, -1 on failure.
+int fork(void);
+// Reserves length bytes of address space; pages are filled on first touch.
+// addr is a hint unless flags has MAP_FIXED. Returns MAP_FAILED on error.
+void *mmap(void *addr, size_t length, int prot, int flags);
+int munmap(void *addr, size_t length);
+int mprotect(void *addr, size_t length, int prot);
 
 #endif
@@ -3,11 +3,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+typedef struct {
+    uint32_t pages_mapped;    // pages the heap has mapped since boot
+    uint32_t pages_unmapped;  // pages it has handed back
+    uint32_t slack_pages;     // mapped pages above the top block right now
+    uint32_t trim_threshold;  // bytes of slack tolerated before kfree trims
+} heap_stats_t;
+
 void heap_init(void);
 void *kmalloc(size_t size);
+// alignment must be a power of two; the result is released with kfree.
 void *kmalloc_aligned(size_t size, size_t alignment);
 void kfree(void *ptr);
 size_t heap_bytes_in_use(void);
 size_t heap_bytes_free(void);
 
+// Unmaps all slack above the top block (memory pressure); returns pages freed.
+uint32_t heap_release_slack(void);
+void heap_set_trim_threshold(size_t bytes);
+void heap_get_stats(heap_stats_t *out);
+
 #endif
@@ -0,0 +1,46 @@
+#ifndef MEM_HEAP_PROFILE_H
+#define MEM_HEAP_PROFILE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation profiler for kmalloc/kfree. Recording is compiled in only when
+// the kernel is built with HEAP_PROFILE=1; otherwise the queries return -1.
+#define HEAP_PROFILE_MAX_LIVE  4096  // live table slots; recording stops at 3/4 full
+#define HEAP_PROFILE_MAX_SITES 128   // distinct call sites
+#define HEAP_PROFILE_BUCKETS   24    // bucket b holds sizes [2^b, 2^(b+1)); the last is open-ended
+
+typedef struct {
+    uint32_t ptr;
+    uint32_t caller;  // return address of the kmalloc call
+    uint32_t size;    // bytes requested
+    uint32_t stamp;   // timer tick of the allocation
+} heap_record_t;
+
+typedef struct {
+    uint32_t caller;
+    uint32_t live_count;
+    uint32_t live_bytes;
+    uint32_t allocs;      // since boot
+    uint32_t alloc_bytes; // since boot
+} heap_site_t;
+
+typedef struct {
+    uint32_t live_count;
+    uint32_t live_bytes;
+    uint32_t sites;
+    uint32_t dropped;        // allocations not recorded because the live table hit its limit
+    uint32_t unattributed;   // allocations whose call site didn't fit the site table
+    uint32_t live_hist[HEAP_PROFILE_BUCKETS];
+    uint32_t alloc_hist[HEAP_PROFILE_BUCKETS];
+} heap_profile_summary_t;
+
+void heap_profile_record(void *ptr, size_t size, void *caller);
+void heap_profile_forget(void *ptr);
+
+int heap_profile_summary(heap_profile_summary_t *out);
+// Enumerates call sites; returns -1 once index is past the last one.
+int heap_profile_site(uint32_t index, heap_site_t *out);
+// Walks the live table from *cursor (start at 0); returns -1 at the end.
+int heap_profile_next_live(uint32_t *cursor, heap_record_t *out);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef MEM_KSWAPD_H
+#define MEM_KSWAPD_H
+#include <stdint.h>
+
+// Background reclaim: a kernel thread that swaps out cold pages once free
+// memory drops below the low watermark, until the high one is restored.
+void kswapd_init(void);
+// Called by allocations that found zone below its low watermark
+void kswapd_wake(uint32_t zone);
+// Times the daemon was woken, and pages it reclaimed
+void kswapd_stats(uint32_t *wakeups, uint32_t *reclaimed);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MEM_LRU_H
+#define MEM_LRU_H
+#include <stdint.h>
+#include "mem/pmm.h"
+
+// Reclaimable user frames, on two global lists linked through the frame
+// descriptors. New frames enter the inactive list; the reclaim scan
+// promotes referenced ones to the active list, and ages the active list
+// back down while it outgrows the inactive one.
+#define LRU_INACTIVE 0
+#define LRU_ACTIVE   1
+
+// Links page at the head of the inactive list (no-op if already linked)
+void lru_add(page_t *page);
+// Unlinks page; pmm_free_frames does this when the last reference goes
+void lru_del(page_t *page);
+// Moves a linked page to the head of list
+void lru_move(page_t *page, int list);
+// Coldest page of list, or NULL if it is empty
+page_t *lru_tail(int list);
+uint32_t lru_count(int list);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef MEM_MEMBLOCK_H
+#define MEM_MEMBLOCK_H
+
+#include <stdint.h>
+
+// Early boot allocator: sorted, merged lists of usable and reserved
+// physical ranges built from the multiboot memory map. It serves the few
+// allocations needed before the PMM exists and tells the PMM which frames
+// to release.
+#define MEMBLOCK_MAX_RANGES 64
+
+typedef struct {
+    uint64_t base;
+    uint64_t end;   // exclusive
+} memblock_range_t;
+
+void memblock_add(uint64_t base, uint64_t size);
+void memblock_reserve(uint64_t base, uint64_t size);
+
+// Takes size bytes, aligned to align (a power of two), from usable and
+// unreserved memory below limit and marks them reserved. Returns 0 on failure.
+uint32_t memblock_alloc(uint32_t size, uint32_t align, uint32_t limit);
+
+// End of the highest usable range.
+uint64_t memblock_end_of_ram(void);
+
+// Iterates usable-minus-reserved ranges in ascending order. Start with
+// *pos = 0; returns 0 once there are no more.
+int memblock_next_free(uint64_t *pos, uint64_t *base, uint64_t *end);
+
+#endif
@@ -2,24 +2,92 @@
 #define MEM_PAGING_H
 #include <stdint.h>
 
+struct vm_space;
+
 #define PAGE_SIZE        0x1000
 #define PAGE_PRESENT     0x00000001
 #define PAGE_RW          0x00000002
 #define PAGE_USER        0x00000004
+#define PAGE_PWT         0x00000008
+#define PAGE_PCD         0x00000010
+#define PAGE_PSE         0x00000080  // in a PDE: maps a 4 MiB page
+#define PAGE_GLOBAL      0x00000100  // kept across CR3 reloads; kernel mappings only
 #define PAGE_SWAPPED     0x00000200
+#define PAGE_COW         0x00000400  // read-only until written, then copied (available bit)
 #define KERNEL_VIRT_BASE 0xC0000000
 
+// Physmap: low memory (below PMM_LOWMEM_LIMIT) is mapped linearly at
+// KERNEL_VIRT_BASE once paging_init has run. Only valid for low frames.
+static inline void *phys_to_virt(uint32_t phys)
+{
+    return (void *)(phys + KERNEL_VIRT_BASE);
+}
+
+static inline uint32_t virt_to_phys(const void *virt)
+{
+    return (uint32_t)virt - KERNEL_VIRT_BASE;
+}
+
 void paging_init(void);
 void paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
 void paging_unmap(uint32_t virt);
 uint32_t paging_virt_to_phys(uint32_t virt);
+void paging_zero_frame(uint32_t phys);
+void paging_copy_frame(uint32_t dst_phys, uint32_t src_phys);
+void paging_reserve_kernel_tables(uint32_t virt, uint32_t size);
+
+// Range versions of map/unmap: one page-table lookup per 4 MiB slot and one
+// batched TLB invalidation at the end (invlpg per page for small batches,
+// a full flush for large ones). paging_map_range maps contiguous frames,
+// paging_map_frames a list of them. paging_unmap_range returns how many
+// pages were mapped and, with free_frames, hands their frames (and any swap
+// slots) back. paging_protect_range sets the RW/USER bits of present pages;
+// copy-on-write pages stay read-only.
+void paging_map_range(uint32_t virt, uint32_t phys, uint32_t pages, uint32_t flags);
+void paging_map_frames(uint32_t virt, const uint32_t *frames, uint32_t pages, uint32_t flags);
+uint32_t paging_unmap_range(uint32_t virt, uint32_t pages, int free_frames);
+void paging_protect_range(uint32_t virt, uint32_t pages, uint32_t flags);
+// Pages invalidated one by one, and batches that fell back to a full flush
+void paging_tlb_stats(uint32_t *pages_flushed, uint32_t *full_flushes);
+// Maps device memory uncached into the MMIO window; returns NULL when it is full.
+void *paging_map_mmio(uint32_t phys, uint32_t size);
+// Same, but leaves the memory type to the MTRRs (framebuffers are usually
+// write-combining there). Large ranges get 4 MiB pages.
+void *paging_map_mmio_cached(uint32_t phys, uint32_t size);
+// Non-zero when the kernel maps use 4 MiB pages (CPU has PSE).
+int paging_large_pages(void);
+// Global kernel translations (CR4.PGE). Returns -1 if the CPU lacks PGE;
+// toggling flushes the whole TLB, global entries included.
+int paging_global_pages(void);
+int paging_set_global_pages(int enable);
+// Drops every translation, global kernel ones too. For kernel mapping
+// changes that invlpg of the touched pages cannot cover.
+void paging_flush_tlb_all(void);
 
 // Per-process page directory management
 uint32_t paging_create_directory(void);
-uint32_t paging_clone_directory(uint32_t src_pd_phys);
+// Returns 0 if a swapped-out page could not be read back for the copy.
+// space (NULL for kernel tasks) gives the copies of swapped pages their rights.
+uint32_t paging_clone_directory(uint32_t src_pd_phys, struct vm_space *space);
 void paging_switch_directory(uint32_t pd_phys);
 void paging_destroy_directory(uint32_t pd_phys);
 uint32_t paging_get_kernel_directory(void);
+uint32_t paging_get_current_directory(void);
+uint32_t paging_cow_fault_count(void);
+// Read faults served by the shared zero page, and later writes that upgraded them
+void paging_zero_page_stats(uint32_t *hits, uint32_t *upgrades);
+
+// Reclaim totals: inactive pages scanned, promoted to the active list,
+// aged back to the inactive list, and swapped out
+void paging_reclaim_stats(uint32_t *scanned, uint32_t *activated,
+                          uint32_t *deactivated, uint32_t *reclaimed);
+
+// Swaps out up to pages cold user pages whose frames can serve zone;
+// returns how many were freed. Used by kswapd.
+uint32_t paging_reclaim(uint32_t zone, uint32_t pages);
+// Allocations that had to reclaim synchronously, and the time they spent
+// doing it (total and worst case, in units of 1024 TSC cycles)
+void paging_stall_stats(uint32_t *stalls, uint32_t *total_kcycles, uint32_t *max_kcycles);
 
 // Manually swap out a page (for testing)
 int paging_swap_out(uint32_t virt);
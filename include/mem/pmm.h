@@ -4,9 +4,92 @@
 #include <stdint.h>
 #include "multiboot.h"
 
+// Largest buddy block: 2^10 frames (4 MiB)
+#define PMM_MAX_ORDER 10
+
+// Zones, in fallback order: an allocation names the highest zone it can
+// use and falls back towards DMA.
+#define PMM_ZONE_DMA     0  // below 16 MiB: legacy DMA and the identity window
+#define PMM_ZONE_NORMAL  1  // up to PMM_LOWMEM_LIMIT
+#define PMM_ZONE_HIGH    2  // everything above
+#define PMM_ZONE_COUNT   3
+
+#define PMM_DMA_LIMIT    0x01000000U
+#define PMM_LOWMEM_LIMIT 0x30000000U
+
+#define PMM_WMARK_MIN    0
+#define PMM_WMARK_LOW    1
+#define PMM_WMARK_HIGH   2
+
+// Per-frame descriptor flags
+#define PG_RESERVED 0x0001  // never given to the allocator (firmware, kernel, holes)
+#define PG_DIRTY    0x0002
+#define PG_LOCKED   0x0004  // pinned: must not be evicted or moved
+#define PG_LRU      0x0008  // linked on an eviction list; mapping names the PTE
+#define PG_SHARED   0x0010  // mapped by several owners (shm); mapping names the owner
+#define PG_ACTIVE   0x0020  // on the active rather than the inactive LRU list
+#define PG_PGTABLE  0x0040  // user page table; mapping names its directory slot
+#define PG_WRITEBACK 0x0080 // picked for a swap write that has not completed
+
+// One descriptor per physical frame, indexed by frame number. The list
+// links are frame numbers rather than pointers to keep the array at 16
+// bytes per frame; frame 0 is never managed, so 0 terminates a list.
+typedef struct page {
+    uint16_t flags;
+    uint16_t count;     // references; 0 while the frame is free
+    void *mapping;      // owner back-pointer, interpreted according to flags
+    uint32_t next;
+    uint32_t prev;
+} page_t;
+
+typedef struct {
+    const char *name;
+    uint32_t start;     // first frame
+    uint32_t end;       // one past the last frame
+    uint32_t managed;   // frames handed to the allocator at boot
+    uint32_t free;
+    uint32_t wmark[3];  // min/low/high, in frames
+} pmm_zone_info_t;
+
 void pmm_init(multiboot_info_t *mb_info);
 uint32_t pmm_alloc_frame(void);
+// Drops one reference; the frame is freed when the last one goes.
 void pmm_free_frame(uint32_t frame);
+
+// Allocate/free 2^order physically contiguous, naturally aligned frames.
+// Every frame of a new block holds one reference. Freeing drops one
+// reference per frame, and any aligned sub-block may be freed on its own.
+uint32_t pmm_alloc_frames(uint32_t order);
+void pmm_free_frames(uint32_t addr, uint32_t order);
+
+// Zone-limited variants; zone is the highest zone the caller accepts.
+uint32_t pmm_alloc_frame_zone(uint32_t zone);
+uint32_t pmm_alloc_frames_zone(uint32_t order, uint32_t zone);
+uint32_t pmm_alloc_zeroed_frame_zone(uint32_t zone);
+// Speculative allocations: fail rather than take a zone below its low
+// watermark, leaving the reserve to reclaim and page tables.
+uint32_t pmm_try_alloc_frame_zone(uint32_t zone);
+uint32_t pmm_try_alloc_zeroed_frame_zone(uint32_t zone);
+
+// Non-zero while the free frames in zones up to zone stay above the mark.
+int pmm_watermark_ok(uint32_t zone, uint32_t mark);
+int pmm_zone_info(uint32_t zone, pmm_zone_info_t *out);
+uint32_t pmm_frame_zone(uint32_t addr);
+
+// Zero-filled frame, taken from the pre-zeroed pool when it has one.
+uint32_t pmm_alloc_zeroed_frame(void);
+// Idle-time work: zero up to budget frames into the pool. Returns frames zeroed.
+uint32_t pmm_zero_pool_refill(uint32_t budget);
+void pmm_zero_pool_stats(uint32_t *available, uint32_t *hits, uint32_t *misses);
+
+// Frame descriptors. pmm_page() returns NULL for addresses the PMM does
+// not describe.
+page_t *pmm_page(uint32_t addr);
+uint32_t pmm_page_addr(const page_t *page);
+void pmm_page_get(uint32_t addr);
+uint32_t pmm_page_count(uint32_t addr);
+
 uint32_t pmm_total_memory(void);
+uint32_t pmm_free_memory(void);
 
 #endif
@@ -19,7 +19,7 @@ typedef struct {
     uint32_t size;          // Size in bytes
     uint32_t pages;         // Number of pages
     int owner_pid;          // Creator PID
-    int ref_count;          // Number of attached processes
+    int ref_count;          // VMA_SHM areas mapping it (plus kernel-task attaches)
     int used;               // Is this slot used?
 } shm_region_t;
 
@@ -36,4 +36,10 @@ void *shm_attach(int id, void *addr, int flags);
 // Detach (unmap) a shared memory region
 int shm_detach(void *addr);
 
+// Area accounting, kept by the VMA code: one reference per VMA_SHM area,
+// taken when an area is inserted, split or copied by fork, and dropped
+// when one is removed
+void shm_region_get(uint32_t id);
+void shm_region_put(uint32_t id);
+
 #endif
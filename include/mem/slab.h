@@ -0,0 +1,42 @@
+#ifndef MEM_SLAB_H
+#define MEM_SLAB_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Smallest and largest kmalloc size classes served from slabs
+#define SLAB_MIN_SIZE 8U
+#define SLAB_MAX_SIZE 2048U
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct {
+    const char *name;
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    uint32_t slabs;          // slabs currently held (partial + full + empty)
+    uint32_t active_objects;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t grows;          // slabs created
+    uint32_t shrinks;        // slabs handed back to the PMM
+} kmem_cache_info_t;
+
+void slab_init(void);
+
+// Fixed-size object caches. Objects are aligned to align (a power of two,
+// at most the page size), or to sizeof(void *) when align is 0.
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+void kmem_cache_destroy(kmem_cache_t *cache);
+
+// Power-of-two caches behind kmalloc. Returns NULL above SLAB_MAX_SIZE.
+kmem_cache_t *kmalloc_cache(size_t size);
+
+// Cache owning obj if it was allocated from a slab, otherwise NULL.
+kmem_cache_t *slab_cache_of(const void *obj);
+
+// Enumerates caches; returns -1 once index is past the last one.
+int kmem_cache_info(uint32_t index, kmem_cache_info_t *out);
+
+#endif
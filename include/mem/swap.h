@@ -3,6 +3,27 @@
 
 #include <stdint.h>
 
+// Most pages swap_out_frames() writes with one command (at most AHCI_MAX_PRDT)
+#define SWAP_BATCH_MAX 16U
+// Most slots a swap-in fault reads with one command
+#define SWAP_RA_MAX 8U
+// Pages read ahead and not yet faulted in that the swap cache holds
+#define SWAP_CACHE_SIZE 32U
+
+typedef struct {
+    uint32_t pages_out;
+    uint32_t writes;      // commands issued for pages_out
+    uint32_t pages_in;
+    uint32_t reads;
+    uint32_t full;        // write attempts that found no free slot
+    uint32_t ra_hits;     // swap-in faults served from the swap cache
+    uint32_t ra_misses;   // swap-in faults that had to read the disk
+    uint32_t ra_pages;    // pages read ahead into the swap cache
+    uint32_t ra_dropped;  // read-ahead pages thrown away unused
+    uint32_t slots_used;
+    uint32_t slots_total;
+} swap_stats_t;
+
 // Initialize the swap subsystem
 void swap_init(void);
 
@@ -11,14 +32,38 @@ void swap_init(void);
 // *swap_slot is updated with the index of the slot used
 int swap_out(void *buffer, uint32_t *swap_slot);
 
+// Write count frames (physical addresses) to swap, as few commands as the
+// free slots allow: adjacent slots are preferred, and runs are halved until
+// they fit. Returns how many leading frames were written; slots[i] gets the
+// slot of frames[i].
+int swap_out_frames(const uint32_t *frames, uint32_t count, uint32_t *slots);
+
 // Read a page from swap space into memory
 // Returns 0 on success, -1 on failure
 int swap_in(uint32_t swap_slot, void *buffer);
 
-// Free a swap slot
+// Read count consecutive slots from first into frames (physical addresses)
+// with one command. Returns 0 on success, -1 on failure
+int swap_in_frames(uint32_t first, const uint32_t *frames, uint32_t count);
+
+// Swap cache: frames holding a copy of a slot that is still in use.
+// Keeps phys for slot, evicting the oldest entry when full
+void swap_cache_add(uint32_t swap_slot, uint32_t phys);
+// Whether slot has a cached copy (not counted)
+int swap_cache_lookup(uint32_t swap_slot);
+// Takes the cached frame for slot out of the cache, counting a hit, or
+// returns 0 and counts a miss
+uint32_t swap_cache_take(uint32_t swap_slot);
+// Frees every cached frame; returns how many
+uint32_t swap_cache_shrink(void);
+
+// Free a swap slot (and any cached copy of it)
 void swap_free(uint32_t swap_slot);
 
 // Check if swap is available
 int swap_available(void);
 
+// Counters since boot, plus the current slot usage
+void swap_get_stats(swap_stats_t *out);
+
 #endif
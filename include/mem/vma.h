@@ -0,0 +1,100 @@
+#ifndef MEM_VMA_H
+#define MEM_VMA_H
+#include <stdint.h>
+
+// User address-space layout. The identity map owns the first 16 MiB; the
+// stack reservation sits right below the kernel half, and mmap places
+// regions top-down below it.
+#define VMA_USER_START      0x01000000U
+#define VMA_USER_END        0xC0000000U
+#define USER_STACK_TOP      VMA_USER_END
+#define USER_STACK_RESERVE  (1024U * 1024U)  // lazily populated below the first pages
+#define USER_STACK_PAGES    4U                // mapped up front
+#define VMA_MMAP_TOP        (USER_STACK_TOP - USER_STACK_RESERVE - 0x1000U) // guard page below the stack
+
+// Access rights (also the mmap/mprotect prot bits)
+#define VMA_READ   0x1U
+#define VMA_WRITE  0x2U
+#define VMA_EXEC   0x4U  // no NX without PAE: implies read
+
+// What backs an area
+#define VMA_ANON   0U
+#define VMA_STACK  1U
+#define VMA_ELF    2U
+#define VMA_SHM    3U
+
+// Fault-around window, in pages: starts at one page and doubles while the
+// faults walk sequentially through an anonymous area
+#define FAULT_AROUND_MIN  1U
+#define FAULT_AROUND_MAX  16U
+
+typedef struct {
+    uint32_t start;   // page aligned
+    uint32_t end;     // exclusive, page aligned
+    uint32_t prot;
+    uint32_t kind;
+    uint32_t object;  // SHM region id for VMA_SHM
+} vma_t;
+
+typedef struct {
+    uint32_t faults;      // page faults taken at user addresses
+    uint32_t prefaulted;  // pages mapped by fault-around, i.e. faults avoided
+    uint32_t windows;     // faults that mapped more than their own page
+} vma_fault_stats_t;
+
+// One per user address space: areas sorted by start, never overlapping,
+// plus the index of the last lookup hit and the fault-around state.
+typedef struct vm_space {
+    vma_t *areas;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t cache;
+    uint32_t window;       // current fault-around size in pages
+    uint32_t window_start; // last window, to spot sequential faults
+    uint32_t window_end;
+    vma_fault_stats_t stats;
+} vm_space_t;
+
+vm_space_t *vma_space_create(void);
+vm_space_t *vma_space_clone(const vm_space_t *src);
+void vma_space_destroy(vm_space_t *space);
+
+// Space checked by the page-fault handler; NULL for kernel tasks, which
+// keep unrestricted demand paging.
+void vma_space_activate(vm_space_t *space);
+vm_space_t *vma_current_space(void);
+
+// Area containing addr, or NULL
+const vma_t *vma_find(vm_space_t *space, uint32_t addr);
+
+// Adds [start, start + size). Returns -1 if it is outside user space,
+// misaligned or overlaps an existing area.
+int vma_insert(vm_space_t *space, uint32_t start, uint32_t size, uint32_t prot,
+               uint32_t kind, uint32_t object);
+// Highest free gap of size bytes below VMA_MMAP_TOP, or 0
+uint32_t vma_find_free(vm_space_t *space, uint32_t size);
+// Cuts [start, start + size) out of whatever areas it touches, splitting
+// them as needed. Does not touch the page tables.
+int vma_remove(vm_space_t *space, uint32_t start, uint32_t size);
+// Changes the rights of [start, start + size), which must be fully covered
+// by areas. Does not touch the page tables.
+int vma_protect(vm_space_t *space, uint32_t start, uint32_t size, uint32_t prot);
+
+// PTE flags for an area's rights
+uint32_t vma_page_flags(uint32_t prot);
+
+// Pages to populate for a demand fault at addr in vma: an aligned window
+// around it, clipped to the area. pages is 1 when fault-around does not
+// apply (non-anonymous area, random access, or disabled).
+void vma_fault_window(vm_space_t *space, const vma_t *vma, uint32_t addr,
+                      uint32_t *start, uint32_t *pages);
+// Global switch, on by default; returns the previous setting
+int vma_set_fault_around(int enable);
+
+// Reserves the stack area in space, maps its top USER_STACK_PAGES in the
+// current directory and returns the stack top, or 0 on failure.
+uint32_t vma_setup_stack(vm_space_t *space);
+// Unmaps every area from the current directory and empties space.
+void vma_space_clear(vm_space_t *space);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef MEM_VMALLOC_H
+#define MEM_VMALLOC_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernel virtual-area window: 128 MiB after the slab window.
+#define VMALLOC_START 0xF2000000U
+#define VMALLOC_SIZE  (128U * 1024U * 1024U)
+#define VMALLOC_END   (VMALLOC_START + VMALLOC_SIZE)
+
+void vmalloc_init(void);
+
+// Page-granular, virtually contiguous allocations backed by any free
+// frames. Each area is followed by an unmapped guard page.
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+int is_vmalloc_addr(const void *ptr);
+
+size_t vmalloc_bytes_in_use(void);
+uint32_t vmalloc_area_count(void);
+
+#endif
@@ -2,6 +2,7 @@
 #define SCHED_SCHED_H
 #include <stdint.h>
 #include "arch/x86/interrupts.h"
+#include "mem/vma.h"
 
 typedef enum {
     TASK_UNUSED = 0,
@@ -15,17 +16,33 @@ typedef struct {
     uint32_t id;
     task_state_t state;
     char name[32];
+    uint32_t faults;      // page faults at user addresses (0 for kernel tasks)
+    uint32_t prefaulted;  // pages mapped ahead by fault-around
 } sched_task_info_t;
 
 typedef void (*sched_iter_cb)(const sched_task_info_t *info);
 
 void sched_init(void);
 int32_t sched_spawn_named(const char *name);
+// Starts a kernel thread running entry
+int32_t sched_spawn_kernel(void (*entry)(void), const char *name);
 int32_t sched_spawn_user(void (*entry)(void), const char *name);
 int32_t sched_spawn_elf(const char *path);
+int32_t sched_fork(interrupt_frame_t *frame);
 int sched_kill(uint32_t id);
 void sched_yield(void);
+// Blocks the calling kernel thread until sched_wake(); returns once it has
+// been scheduled again, or at once if a wake arrived since the last sleep
+// (a wake is remembered while the task is not asleep)
+void sched_sleep(void);
+// Returns 1 if the task was asleep; otherwise the wake is kept pending
+int sched_wake(uint32_t id);
 uint32_t sched_get_current_pid(void);
+// Gives the current task an address space (exec from a task without one)
+void sched_set_current_vm(vm_space_t *space);
+// Kills the current task from an exception handler and switches away.
+// Returns -1 if there is nothing else to run.
+int sched_exit_current(interrupt_frame_t *frame);
 interrupt_frame_t *sched_tick(interrupt_frame_t *frame);
 uint32_t sched_task_count(void);
 void sched_for_each(sched_iter_cb cb);
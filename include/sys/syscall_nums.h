@@ -7,7 +7,18 @@
 #define SYS_YIELD   3
 #define SYS_GETPID  4
 #define SYS_EXEC    5
+#define SYS_FORK    6
+#define SYS_MMAP    7
+#define SYS_MUNMAP  8
+#define SYS_MPROTECT 9
 
-#define SYSCALL_MAX 6
+#define SYSCALL_MAX 10
+
+// mmap/mprotect protection bits and mmap flags
+#define PROT_NONE   0x0
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+#define MAP_FIXED   0x10
 
 #endif
@@ -13,6 +13,8 @@ typedef struct framebuffer_info {
 } framebuffer_info_t;
 
 void framebuffer_init(multiboot_info_t *mb_info);
+// Moves the framebuffer into the kernel MMIO window once paging is up.
+void framebuffer_remap(void);
 int framebuffer_available(void);
 const framebuffer_info_t *framebuffer_query(void);
 
@@ -0,0 +1,104 @@
+#include "apps/ctxbench.h"
+#include "ui/console.h"
+#include "mem/pmm.h"
+#include "mem/paging.h"
+#include "mem/vmalloc.h"
+#include "arch/x86/cpu.h"
+
+#define BENCH_BASE    0x40000000U /* user range, as in forkbench */
+#define USER_PAGES    16U
+#define KERNEL_PAGES  64U         /* kernel working set touched per slice */
+#define ROUNDS        2000U
+
+/* Stands in for the kernel data a slice touches: 4 KiB global mappings. */
+static uint32_t kernel_set = 0;
+
+/* A "process": its own directory with a few private, dirtied user pages. */
+static uint32_t make_process(void)
+{
+    uint32_t pd = paging_create_directory();
+    uint32_t home = paging_get_current_directory();
+    paging_switch_directory(pd);
+    for (uint32_t i = 0; i < USER_PAGES; ++i) {
+        uint32_t phys = pmm_alloc_frame();
+        if (!phys) {
+            break;
+        }
+        paging_map(BENCH_BASE + i * PAGE_SIZE, phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+        *(volatile uint32_t *)(BENCH_BASE + i * PAGE_SIZE) = i;
+    }
+    paging_switch_directory(home);
+    return pd;
+}
+
+/* One time slice: touch the process's pages, then a kernel working set. */
+static void slice(uint32_t pd)
+{
+    paging_switch_directory(pd);
+    for (uint32_t i = 0; i < USER_PAGES; ++i) {
+        (void)*(volatile uint32_t *)(BENCH_BASE + i * PAGE_SIZE);
+    }
+    for (uint32_t i = 0; i < KERNEL_PAGES; ++i) {
+        (void)*(volatile uint32_t *)(kernel_set + i * PAGE_SIZE + ((i & 63U) << 6));
+    }
+}
+
+static uint32_t run(uint32_t a, uint32_t b)
+{
+    slice(a);
+    slice(b);
+    uint64_t t0 = cpu_rdtsc();
+    for (uint32_t r = 0; r < ROUNDS; ++r) {
+        slice(a);
+        slice(b);
+    }
+    uint64_t t1 = cpu_rdtsc();
+    return (uint32_t)(t1 - t0) / (2U * ROUNDS);
+}
+
+/*
+ * Switches between two address spaces and touches the same user and kernel
+ * pages in each slice, once with global kernel pages and once without. The
+ * difference is the kernel TLB refill that CR3 reloads no longer cause.
+ */
+void app_ctxbench(void)
+{
+    int global = paging_global_pages();
+    if (global < 0) {
+        console_write("ctxbench: CPU has no PGE, kernel pages cannot be global\n");
+        return;
+    }
+    void *set = vmalloc(KERNEL_PAGES * PAGE_SIZE);
+    if (!set) {
+        console_write("ctxbench: vmalloc failed\n");
+        return;
+    }
+    kernel_set = (uint32_t)set;
+    uint32_t home = paging_get_current_directory();
+    uint32_t a = make_process();
+    uint32_t b = make_process();
+
+    uint32_t irq = cpu_save_irq();
+    paging_set_global_pages(0);
+    uint32_t flat = run(a, b);
+    paging_set_global_pages(1);
+    uint32_t with_global = run(a, b);
+    paging_set_global_pages(global);
+    paging_switch_directory(home);
+    cpu_restore_irq(irq);
+
+    paging_destroy_directory(a);
+    paging_destroy_directory(b);
+    vfree(set);
+
+    console_write("cycles per switch + slice (");
+    console_write_dec(USER_PAGES);
+    console_write(" user, ");
+    console_write_dec(KERNEL_PAGES);
+    console_write(" kernel pages)\n");
+    console_write("  without PGE: ");
+    console_write_dec(flat);
+    console_write("\n  with PGE:    ");
+    console_write_dec(with_global);
+    console_putc('\n');
+}
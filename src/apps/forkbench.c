@@ -0,0 +1,88 @@
+#include "apps/forkbench.h"
+#include "ui/console.h"
+#include "mem/pmm.h"
+#include "mem/paging.h"
+#include "arch/x86/cpu.h"
+
+#define BENCH_BASE 0x40000000U /* user range, clear of the identity map and the ELF load address */
+
+static const uint32_t resident_pages[] = { 16, 64, 256, 1024, 4096 };
+
+/* Maps pages fresh frames at BENCH_BASE in the current directory and dirties each. */
+static uint32_t populate(uint32_t pages)
+{
+    for (uint32_t i = 0; i < pages; ++i) {
+        uint32_t phys = pmm_alloc_frame();
+        if (!phys) {
+            return i;
+        }
+        uint32_t virt = BENCH_BASE + i * PAGE_SIZE;
+        paging_map(virt, phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+        *(volatile uint32_t *)virt = i;
+    }
+    return pages;
+}
+
+/*
+ * Clones a scratch address space of growing resident size. "clone" is the
+ * paging_clone_directory call itself; "write all" is the child then writing
+ * one word per page, which is where copy-on-write pays for the copies.
+ */
+void app_forkbench(void)
+{
+    console_write("pages   clone cyc  per page   write-all cyc  cow faults\n");
+    uint32_t irq = cpu_save_irq();
+    uint32_t home = paging_get_current_directory();
+
+    for (uint32_t n = 0; n < sizeof(resident_pages) / sizeof(resident_pages[0]); ++n) {
+        uint32_t pages = resident_pages[n];
+        /* parent + child copies + page tables, with room to spare */
+        if (pmm_free_memory() / PAGE_SIZE < 2U * pages + 64U) {
+            console_write("  (stopping: not enough free memory for ");
+            console_write_dec(pages);
+            console_write(" pages)\n");
+            break;
+        }
+
+        uint32_t parent = paging_create_directory();
+        paging_switch_directory(parent);
+        uint32_t mapped = populate(pages);
+
+        uint32_t faults0 = paging_cow_fault_count();
+        uint64_t t0 = cpu_rdtsc();
+        uint32_t child = paging_clone_directory(parent, NULL);
+        uint64_t t1 = cpu_rdtsc();
+        if (!child) {
+            console_write("  (stopping: clone failed)\n");
+            paging_switch_directory(home);
+            paging_destroy_directory(parent);
+            break;
+        }
+
+        paging_switch_directory(child);
+        uint64_t t2 = cpu_rdtsc();
+        for (uint32_t i = 0; i < mapped; ++i) {
+            *(volatile uint32_t *)(BENCH_BASE + i * PAGE_SIZE) = ~i;
+        }
+        uint64_t t3 = cpu_rdtsc();
+        uint32_t faults = paging_cow_fault_count() - faults0;
+
+        paging_switch_directory(parent);
+        paging_destroy_directory(child);
+        paging_switch_directory(home);
+        paging_destroy_directory(parent);
+
+        uint32_t clone_cyc = (uint32_t)(t1 - t0);
+        console_write_dec(mapped);
+        console_write("\t");
+        console_write_dec(clone_cyc);
+        console_write("\t");
+        console_write_dec(mapped ? clone_cyc / mapped : 0);
+        console_write("\t");
+        console_write_dec((uint32_t)(t3 - t2));
+        console_write("\t");
+        console_write_dec(faults);
+        console_putc('\n');
+    }
+    cpu_restore_irq(irq);
+}
@@ -0,0 +1,161 @@
+#include "apps/heapstat.h"
+#include "ui/console.h"
+#include "mem/heap.h"
+#include "mem/heap_profile.h"
+#include "drivers/virtio_console.h"
+#include "arch/x86/timer.h"
+#include <string.h>
+
+#define TOP_SITES 10
+
+static void write_padded(uint32_t value, uint32_t width)
+{
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        ++digits;
+    }
+    while (digits++ < width) {
+        console_putc(' ');
+    }
+    console_write_dec(value);
+}
+
+static char *append_hex(char *out, uint32_t v)
+{
+    const char *hex = "0123456789abcdef";
+    *out++ = '0';
+    *out++ = 'x';
+    for (int i = 28; i >= 0; i -= 4) {
+        *out++ = hex[(v >> i) & 0xF];
+    }
+    return out;
+}
+
+static char *append_dec(char *out, uint32_t v)
+{
+    char buf[12];
+    int i = 0;
+    do {
+        buf[i++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (i--) {
+        *out++ = buf[i];
+    }
+    return out;
+}
+
+/* One "ptr caller size age" line per live allocation, for addr2line offline. */
+static void dump_live(void)
+{
+    if (!virtio_console_available()) {
+        console_write("heapstat: no virtio console to dump to\n");
+        return;
+    }
+    uint32_t now = (uint32_t)timer_ticks();
+    uint32_t cursor = 0;
+    uint32_t count = 0;
+    heap_record_t rec;
+    char line[64];
+    virtio_console_write("# heapstat live allocations: ptr caller size age_ticks\n");
+    while (heap_profile_next_live(&cursor, &rec) == 0) {
+        char *p = append_hex(line, rec.ptr);
+        *p++ = ' ';
+        p = append_hex(p, rec.caller);
+        *p++ = ' ';
+        p = append_dec(p, rec.size);
+        *p++ = ' ';
+        p = append_dec(p, now - rec.stamp);
+        *p++ = '\n';
+        *p = '\0';
+        virtio_console_write(line);
+        ++count;
+    }
+    virtio_console_write("# end\n");
+    console_write_dec(count);
+    console_write(" live allocations written to the virtio console\n");
+}
+
+static void show_top_sites(void)
+{
+    /* Repeated selection: the site table is small. */
+    uint32_t last_bytes = 0xFFFFFFFFU;
+    uint32_t last_caller = 0;
+    console_write("call site      live objs  live bytes    allocs   alloc bytes\n");
+    for (uint32_t n = 0; n < TOP_SITES; ++n) {
+        heap_site_t best;
+        int found = 0;
+        heap_site_t site;
+        for (uint32_t i = 0; heap_profile_site(i, &site) == 0; ++i) {
+            /* Order by (live_bytes desc, caller asc), strictly after the last one shown. */
+            if (site.live_bytes > last_bytes ||
+                (site.live_bytes == last_bytes && site.caller <= last_caller)) {
+                continue;
+            }
+            if (!found || site.live_bytes > best.live_bytes ||
+                (site.live_bytes == best.live_bytes && site.caller < best.caller)) {
+                best = site;
+                found = 1;
+            }
+        }
+        if (!found || best.live_count == 0) {
+            break;
+        }
+        console_write_hex(best.caller);
+        write_padded(best.live_count, 14);
+        write_padded(best.live_bytes, 12);
+        write_padded(best.allocs, 10);
+        write_padded(best.alloc_bytes, 14);
+        console_putc('\n');
+        last_bytes = best.live_bytes;
+        last_caller = best.caller;
+    }
+}
+
+static void show_histogram(const heap_profile_summary_t *s)
+{
+    console_write("size class        live    allocs\n");
+    for (uint32_t b = 0; b < HEAP_PROFILE_BUCKETS; ++b) {
+        if (!s->alloc_hist[b]) {
+            continue;
+        }
+        console_write(b + 1U < HEAP_PROFILE_BUCKETS ? "< " : ">=");
+        write_padded(b + 1U < HEAP_PROFILE_BUCKETS ? 1U << (b + 1U) : 1U << b, 9);
+        write_padded(s->live_hist[b], 10);
+        write_padded(s->alloc_hist[b], 10);
+        console_putc('\n');
+    }
+}
+
+void app_heapstat(const char *args)
+{
+    heap_profile_summary_t s;
+    if (heap_profile_summary(&s) != 0) {
+        console_write("heapstat: profiler not built in (rebuild with make HEAP_PROFILE=1)\n");
+        console_write("Heap bytes in use: ");
+        console_write_dec(heap_bytes_in_use());
+        console_putc('\n');
+        return;
+    }
+    if (args && !strcmp(args, "dump")) {
+        dump_live();
+        return;
+    }
+    console_write("Live: ");
+    console_write_dec(s.live_count);
+    console_write(" allocations, ");
+    console_write_dec(s.live_bytes);
+    console_write(" bytes from ");
+    console_write_dec(s.sites);
+    console_write(" call sites");
+    if (s.dropped || s.unattributed) {
+        console_write(" (untracked ");
+        console_write_dec(s.dropped);
+        console_write(", unattributed ");
+        console_write_dec(s.unattributed);
+        console_putc(')');
+    }
+    console_putc('\n');
+    show_top_sites();
+    show_histogram(&s);
+}
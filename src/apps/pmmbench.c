@@ -0,0 +1,82 @@
+#include "apps/pmmbench.h"
+#include "ui/console.h"
+#include "mem/pmm.h"
+#include "mem/heap.h"
+#include "arch/x86/cpu.h"
+
+#define BENCH_ITERATIONS 1000
+
+static const uint32_t occupancy_levels[] = { 10, 50, 99 };
+
+/*
+ * Measures order-0 alloc/free cost with the PMM filled to a fraction of the
+ * memory that was free when the benchmark started. The held frames are kept
+ * in a kmalloc'd array allocated up front so the heap does not need to grow
+ * while physical memory is nearly exhausted.
+ */
+void app_pmmbench(void)
+{
+    uint32_t capacity = pmm_free_memory() / 4096U;
+    uint32_t *held = (uint32_t *)kmalloc(capacity * sizeof(uint32_t));
+    if (!held) {
+        console_write("pmmbench: cannot allocate frame list\n");
+        return;
+    }
+    uint32_t baseline = pmm_free_memory() / 4096U;
+    uint32_t count = 0;
+
+    console_write("pmmbench: ");
+    console_write_dec(baseline);
+    console_write(" free frames, ");
+    console_write_dec(BENCH_ITERATIONS);
+    console_write(" alloc/free pairs per level\n");
+
+    uint32_t irq = cpu_save_irq();
+    for (uint32_t level = 0; level < sizeof(occupancy_levels) / sizeof(occupancy_levels[0]); ++level) {
+        uint32_t target = (baseline / 100U) * occupancy_levels[level] +
+                          (baseline % 100U) * occupancy_levels[level] / 100U;
+        while (count < target && count < capacity) {
+            uint32_t frame = pmm_alloc_frame();
+            if (!frame) {
+                break;
+            }
+            held[count++] = frame;
+        }
+
+        uint32_t alloc_total = 0, free_total = 0;
+        uint32_t alloc_max = 0, free_max = 0;
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; ++i) {
+            uint64_t t0 = cpu_rdtsc();
+            uint32_t frame = pmm_alloc_frame();
+            uint64_t t1 = cpu_rdtsc();
+            pmm_free_frame(frame);
+            uint64_t t2 = cpu_rdtsc();
+            uint32_t a = (uint32_t)(t1 - t0);
+            uint32_t f = (uint32_t)(t2 - t1);
+            alloc_total += a;
+            free_total += f;
+            if (a > alloc_max) alloc_max = a;
+            if (f > free_max) free_max = f;
+        }
+
+        cpu_restore_irq(irq);
+        console_write("  ");
+        console_write_dec(occupancy_levels[level]);
+        console_write("% used: alloc avg ");
+        console_write_dec(alloc_total / BENCH_ITERATIONS);
+        console_write(" cyc (max ");
+        console_write_dec(alloc_max);
+        console_write("), free avg ");
+        console_write_dec(free_total / BENCH_ITERATIONS);
+        console_write(" cyc (max ");
+        console_write_dec(free_max);
+        console_write(")\n");
+        irq = cpu_save_irq();
+    }
+
+    while (count > 0) {
+        pmm_free_frame(held[--count]);
+    }
+    cpu_restore_irq(irq);
+    kfree(held);
+}
@@ -0,0 +1,40 @@
+#include "apps/slabinfo.h"
+#include "ui/console.h"
+#include "mem/slab.h"
+
+static void write_padded(uint32_t value, uint32_t width)
+{
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        ++digits;
+    }
+    while (digits++ < width) {
+        console_putc(' ');
+    }
+    console_write_dec(value);
+}
+
+void app_slabinfo(void)
+{
+    console_write("cache           size  objs/slab  slabs  active   allocs    frees  grows shrinks\n");
+    kmem_cache_info_t info;
+    for (uint32_t i = 0; kmem_cache_info(i, &info) == 0; ++i) {
+        console_write(info.name);
+        uint32_t len = 0;
+        while (info.name[len]) {
+            ++len;
+        }
+        while (len++ < 12) {
+            console_putc(' ');
+        }
+        write_padded(info.object_size, 8);
+        write_padded(info.objects_per_slab, 11);
+        write_padded(info.slabs, 7);
+        write_padded(info.active_objects, 8);
+        write_padded(info.allocs, 9);
+        write_padded(info.frees, 9);
+        write_padded(info.grows, 7);
+        write_padded(info.shrinks, 8);
+        console_putc('\n');
+    }
+}
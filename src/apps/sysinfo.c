@@ -1,6 +1,12 @@
 #include "apps/sysinfo.h"
 #include "ui/console.h"
 #include "mem/pmm.h"
+#include "mem/heap.h"
+#include "mem/paging.h"
+#include "mem/vmalloc.h"
+#include "mem/lru.h"
+#include "mem/kswapd.h"
+#include "mem/swap.h"
 #include "arch/x86/timer.h"
 #include "sched/sched.h"
 
@@ -9,7 +15,116 @@ void app_sysinfo(void)
     console_write("-- PenOS System Info --\n");
     console_write("Total memory: ");
     console_write_dec(pmm_total_memory() / 1024);
-    console_write(" KB\nTicks: ");
+    console_write(" KB\nFree memory: ");
+    console_write_dec(pmm_free_memory() / 1024);
+    uint32_t ready, hits, misses;
+    pmm_zero_pool_stats(&ready, &hits, &misses);
+    console_write(" KB\nZeroed frames: ");
+    console_write_dec(ready);
+    console_write(" ready (hits ");
+    console_write_dec(hits);
+    console_write(", misses ");
+    console_write_dec(misses);
+    console_write(")\n");
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; ++z) {
+        pmm_zone_info_t info;
+        if (pmm_zone_info(z, &info) != 0 || info.managed == 0) {
+            continue;
+        }
+        console_write("Zone ");
+        console_write(info.name);
+        console_write(": ");
+        console_write_dec(info.free * 4);
+        console_write(" / ");
+        console_write_dec(info.managed * 4);
+        console_write(" KB free\n");
+    }
+    heap_stats_t heap;
+    heap_get_stats(&heap);
+    console_write("Heap: ");
+    console_write_dec(heap_bytes_in_use() / 1024);
+    console_write(" KB used, ");
+    console_write_dec(heap.slack_pages * 4);
+    console_write(" KB slack (pages mapped ");
+    console_write_dec(heap.pages_mapped);
+    console_write(", unmapped ");
+    console_write_dec(heap.pages_unmapped);
+    console_write(")\n");
+    uint32_t zero_hits, zero_upgrades;
+    paging_zero_page_stats(&zero_hits, &zero_upgrades);
+    console_write("Zero page: ");
+    console_write_dec(zero_hits);
+    console_write(" read faults shared (");
+    console_write_dec(zero_upgrades);
+    console_write(" later written), COW faults ");
+    console_write_dec(paging_cow_fault_count());
+    console_putc('\n');
+    uint32_t tlb_pages, tlb_full;
+    paging_tlb_stats(&tlb_pages, &tlb_full);
+    console_write("TLB: ");
+    console_write_dec(tlb_pages);
+    console_write(" pages invalidated by range ops, ");
+    console_write_dec(tlb_full);
+    console_write(" full flushes\n");
+    uint32_t scanned, activated, deactivated, reclaimed;
+    paging_reclaim_stats(&scanned, &activated, &deactivated, &reclaimed);
+    console_write("LRU: ");
+    console_write_dec(lru_count(LRU_ACTIVE));
+    console_write(" active, ");
+    console_write_dec(lru_count(LRU_INACTIVE));
+    console_write(" inactive; scanned ");
+    console_write_dec(scanned);
+    console_write(", promoted ");
+    console_write_dec(activated);
+    console_write(", aged ");
+    console_write_dec(deactivated);
+    console_write(", reclaimed ");
+    console_write_dec(reclaimed);
+    console_putc('\n');
+    uint32_t wakeups, background, stalls, stall_total, stall_max;
+    kswapd_stats(&wakeups, &background);
+    paging_stall_stats(&stalls, &stall_total, &stall_max);
+    console_write("Reclaim: kswapd woken ");
+    console_write_dec(wakeups);
+    console_write("x, ");
+    console_write_dec(background);
+    console_write(" pages in background; ");
+    console_write_dec(stalls);
+    console_write(" allocation stalls, avg ");
+    console_write_dec(stalls ? stall_total / stalls : 0);
+    console_write(" max ");
+    console_write_dec(stall_max);
+    console_write(" kcycles\n");
+    swap_stats_t swap;
+    swap_get_stats(&swap);
+    console_write("Swap: ");
+    console_write_dec(swap.pages_out);
+    console_write(" pages out in ");
+    console_write_dec(swap.writes);
+    console_write(" writes, ");
+    console_write_dec(swap.pages_in);
+    console_write(" in; ");
+    console_write_dec(swap.slots_used);
+    console_write("/");
+    console_write_dec(swap.slots_total);
+    console_write(" slots used, ");
+    console_write_dec(swap.full);
+    console_write(" times full\n");
+    console_write("Swap readahead: ");
+    console_write_dec(swap.ra_hits);
+    console_write(" hits, ");
+    console_write_dec(swap.ra_misses);
+    console_write(" misses; ");
+    console_write_dec(swap.ra_pages);
+    console_write(" pages read ahead, ");
+    console_write_dec(swap.ra_dropped);
+    console_write(" dropped unused\n");
+    console_write("vmalloc: ");
+    console_write_dec(vmalloc_bytes_in_use() / 1024);
+    console_write(" KB in ");
+    console_write_dec(vmalloc_area_count());
+    console_write(" areas\n");
+    console_write("Ticks: ");
     console_write_dec((uint32_t)timer_ticks());
     console_write("\nTasks: ");
     console_write_dec(sched_task_count());
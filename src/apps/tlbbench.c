@@ -0,0 +1,75 @@
+#include "apps/tlbbench.h"
+#include "ui/console.h"
+#include "mem/pmm.h"
+#include "mem/memblock.h"
+#include "mem/paging.h"
+#include "mem/vmalloc.h"
+#include "arch/x86/cpu.h"
+
+#define WALK_PASSES   8
+#define PHYSMAP_BASE  (16U * 1024U * 1024U) /* past the kernel image and the DMA zone */
+
+static const uint32_t walk_mib[] = { 1, 4, 16, 32 };
+
+/*
+ * Reads one word per page, PASSES times. The offset inside each page moves
+ * by a cache line per page so the walk does not keep hitting the same cache
+ * set; what is left is dominated by TLB reach. Returns cycles per access.
+ */
+static uint32_t walk(uint32_t base, uint32_t pages)
+{
+    volatile uint32_t sink = 0;
+    uint64_t t0 = cpu_rdtsc();
+    for (uint32_t pass = 0; pass < WALK_PASSES; ++pass) {
+        for (uint32_t i = 0; i < pages; ++i) {
+            sink += *(volatile uint32_t *)(base + i * PAGE_SIZE + ((i & 63U) << 6));
+        }
+    }
+    uint64_t t1 = cpu_rdtsc();
+    (void)sink;
+    return (uint32_t)(t1 - t0) / (pages * WALK_PASSES);
+}
+
+/*
+ * Walks the same amount of kernel memory through the physmap (4 MiB pages)
+ * and through a vmalloc area (4 KiB pages). The gap is the cost of the extra
+ * TLB misses.
+ */
+void app_tlbbench(void)
+{
+    uint64_t ram_end = memblock_end_of_ram();
+    uint32_t lowmem_end = ram_end < PMM_LOWMEM_LIMIT ? (uint32_t)ram_end : PMM_LOWMEM_LIMIT;
+
+    console_write(paging_large_pages() ? "physmap uses 4 MiB pages\n"
+                                       : "no PSE: physmap uses 4 KiB pages too\n");
+    console_write("MiB   physmap cyc/page   vmalloc cyc/page\n");
+    for (uint32_t n = 0; n < sizeof(walk_mib) / sizeof(walk_mib[0]); ++n) {
+        uint32_t bytes = walk_mib[n] * 1024U * 1024U;
+        uint32_t pages = bytes / PAGE_SIZE;
+        if (PHYSMAP_BASE + bytes > lowmem_end) {
+            console_write("  (stopping: low memory too small)\n");
+            break;
+        }
+        void *area = vmalloc(bytes);
+        if (!area) {
+            console_write("  (stopping: vmalloc failed)\n");
+            break;
+        }
+
+        uint32_t irq = cpu_save_irq();
+        uint32_t direct_base = (uint32_t)phys_to_virt(PHYSMAP_BASE);
+        walk(direct_base, pages); /* warm the caches for both runs */
+        walk((uint32_t)area, pages);
+        uint32_t direct = walk(direct_base, pages);
+        uint32_t small = walk((uint32_t)area, pages);
+        cpu_restore_irq(irq);
+        vfree(area);
+
+        console_write_dec(walk_mib[n]);
+        console_write("\t");
+        console_write_dec(direct);
+        console_write("\t\t");
+        console_write_dec(small);
+        console_putc('\n');
+    }
+}
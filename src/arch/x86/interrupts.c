@@ -148,7 +148,7 @@ void interrupt_init(void)
     set_gate(45, isr45);
     set_gate(46, isr46);
     set_gate(47, isr47);
-    set_gate(128, isr128);
+    idt_set_entry(128, isr128, 0x08, 0xEE); // DPL 3 so ring 3 can issue int 0x80
 
     mouse_init();
 }
@@ -4,6 +4,7 @@
 #include <ui/console.h>
 #include <mem/heap.h>
 #include <mem/paging.h>
+#include <mem/pmm.h>
 #include <string.h>
 #include <arch/x86/interrupts.h>
 
@@ -18,8 +19,28 @@ static int port_count = 0;
 static int port_status[32] = {0};      // 0=Disconnected, 1=Connected
 static int port_initialized[32] = {0}; // 0=Not Initialized, 1=Initialized
 
+// Writes a physical address into an AHCI low/high register pair. The
+// high half is only non-zero for memory above 4 GiB, which the HBA can
+// reach when it reports CAP.S64A.
+#define AHCI_SET_DMA_ADDR(lo, hi, phys) do {            \
+        uint64_t dma_addr_ = (uint64_t)(phys);          \
+        (lo) = (uint32_t)dma_addr_;                     \
+        (hi) = (uint32_t)(dma_addr_ >> 32);             \
+    } while (0)
+
+// Per-port DMA memory: one 32 KiB low-memory block holding the command
+// list (offset 0, 1K), the received-FIS area (offset 1K, 256 bytes) and the
+// 32 command tables (512 bytes each, room for AHCI_MAX_PRDT entries, from
+// offset 4K). It is reached through the physmap, so no translation is
+// needed to program the HBA.
+#define PORT_MEM_ORDER   3
+#define PORT_MEM_FB      0x400
+#define PORT_MEM_CTBA    0x1000
+#define PORT_MEM_CTBA_SZ 512
+
 // Virtual addresses for port structures (needed by driver)
 static struct {
+    uint32_t mem_phys;
     uint32_t clb;
     uint32_t fb;
     uint32_t ctba[32];
@@ -123,35 +144,54 @@ static void start_cmd(hba_port_t *port) {
     port->cmd |= AHCI_CMD_ST;
 }
 
+// Release the command list, FIS area and command tables of a port
+static void ahci_port_release(int portno) {
+    if (port_virt[portno].mem_phys) {
+        pmm_free_frames(port_virt[portno].mem_phys, PORT_MEM_ORDER);
+    }
+    for (int i = 0; i < 32; i++) {
+        port_virt[portno].ctba[i] = 0;
+    }
+    port_virt[portno].mem_phys = 0;
+    port_virt[portno].clb = 0;
+    port_virt[portno].fb = 0;
+}
+
 // Rebase port memory (allocate command lists and FIS)
 static int ahci_port_rebase(hba_port_t *port, int portno) {
     stop_cmd(port);
+    ahci_port_release(portno); // hot-plug: drop the previous rebase's buffers
+
+    uint32_t mem_phys = pmm_alloc_frames_zone(PORT_MEM_ORDER, PMM_ZONE_NORMAL);
+    if (!mem_phys) {
+        console_write("AHCI: Out of memory rebasing port ");
+        console_write_dec(portno);
+        console_write("\n");
+        return -1;
+    }
+    port_virt[portno].mem_phys = mem_phys;
+    memset(phys_to_virt(mem_phys), 0, PAGE_SIZE << PORT_MEM_ORDER);
 
     // Command list (1K aligned)
-    uint32_t cmd_list_addr = (uint32_t)kmalloc_aligned(1024, 1024);
+    uint32_t cmd_list_addr = (uint32_t)phys_to_virt(mem_phys);
     port_virt[portno].clb = cmd_list_addr;
-    port->clb = paging_virt_to_phys(cmd_list_addr);
-    port->clbu = 0;
-    memset((void*)cmd_list_addr, 0, 1024);
+    AHCI_SET_DMA_ADDR(port->clb, port->clbu, mem_phys);
 
     // FIS (256 bytes aligned)
-    uint32_t fis_addr = (uint32_t)kmalloc_aligned(256, 256);
+    uint32_t fis_addr = cmd_list_addr + PORT_MEM_FB;
     port_virt[portno].fb = fis_addr;
-    port->fb = paging_virt_to_phys(fis_addr);
-    port->fbu = 0;
-    memset((void*)fis_addr, 0, 256);
+    AHCI_SET_DMA_ADDR(port->fb, port->fbu, mem_phys + PORT_MEM_FB);
 
     // Command table (one per command slot, we support 32 slots)
     hba_cmd_header_t *cmd_header = (hba_cmd_header_t*)cmd_list_addr;
     for (int i = 0; i < 32; i++) {
-        cmd_header[i].prdtl = 8; // 8 PRDT entries per command
+        cmd_header[i].prdtl = AHCI_MAX_PRDT;
         
-        uint32_t cmd_table_addr = (uint32_t)kmalloc_aligned(256, 256);
-        port_virt[portno].ctba[i] = cmd_table_addr;
+        uint32_t cmd_table_off = PORT_MEM_CTBA + (uint32_t)i * PORT_MEM_CTBA_SZ;
+        port_virt[portno].ctba[i] = cmd_list_addr + cmd_table_off;
         
-        cmd_header[i].ctba = paging_virt_to_phys(cmd_table_addr);
-        cmd_header[i].ctbau = 0;
-        memset((void*)cmd_table_addr, 0, 256);
+        AHCI_SET_DMA_ADDR(cmd_header[i].ctba, cmd_header[i].ctbau,
+                          mem_phys + cmd_table_off);
     }
     
     // Enable Port Interrupts
@@ -187,17 +227,22 @@ int ahci_init(void) {
     uint32_t bar5 = pci_read_config(pci_dev->bus, pci_dev->device, pci_dev->function, 0x24);
     uint32_t abar_phys = bar5 & 0xFFFFFFF0;
     
-    // Map ABAR to virtual memory
-    uint32_t abar_virt = 0xE0000000;
-    paging_map(abar_virt, abar_phys, PAGE_RW | PAGE_PRESENT);
-    
-    abar = (hba_mem_t *)abar_virt;
+    // Map ABAR (generic registers plus 32 port blocks) uncached
+    abar = (hba_mem_t *)paging_map_mmio(abar_phys,
+        sizeof(hba_mem_t) + 31 * sizeof(hba_port_t));
+    if (!abar) {
+        console_write("AHCI: No room to map ABAR\n");
+        return -1;
+    }
 
     console_write("AHCI: ABAR mapped at 0x");
     console_write_hex((uint32_t)abar);
     console_write(" (phys 0x");
     console_write_hex(abar_phys);
     console_write(")\n");
+    if (!(abar->cap & AHCI_CAP_S64A)) {
+        console_write("AHCI: HBA limited to 32-bit DMA addresses\n");
+    }
 
     // Enable AHCI mode
     abar->ghc |= AHCI_GHC_AE;
@@ -279,7 +324,8 @@ int ahci_identify(int port, uint16_t *buffer) {
     hba_cmd_table_t *cmd_table = (hba_cmd_table_t*)port_virt[port].ctba[slot];
     memset(cmd_table, 0, sizeof(hba_cmd_table_t) + (cmd_header->prdtl - 1) * sizeof(hba_prdt_entry_t));
     
-    cmd_table->prdt_entry[0].dba = paging_virt_to_phys((uint32_t)buffer);
+    AHCI_SET_DMA_ADDR(cmd_table->prdt_entry[0].dba, cmd_table->prdt_entry[0].dbau,
+                      paging_virt_to_phys((uint32_t)buffer));
     cmd_table->prdt_entry[0].dbc = 511;
     cmd_table->prdt_entry[0].i = 1;
     
@@ -328,7 +374,8 @@ int ahci_read(int port, uint64_t lba, uint16_t count, void *buffer) {
     hba_cmd_table_t *cmd_table = (hba_cmd_table_t*)port_virt[port].ctba[slot];
     memset(cmd_table, 0, sizeof(hba_cmd_table_t) + (cmd_header->prdtl - 1) * sizeof(hba_prdt_entry_t));
     
-    cmd_table->prdt_entry[0].dba = paging_virt_to_phys((uint32_t)buffer);
+    AHCI_SET_DMA_ADDR(cmd_table->prdt_entry[0].dba, cmd_table->prdt_entry[0].dbau,
+                      paging_virt_to_phys((uint32_t)buffer));
     cmd_table->prdt_entry[0].dbc = (count * 512) - 1;
     cmd_table->prdt_entry[0].i = 1;
     
@@ -388,7 +435,8 @@ int ahci_write(int port, uint64_t lba, uint16_t count, const void *buffer) {
     hba_cmd_table_t *cmd_table = (hba_cmd_table_t*)port_virt[port].ctba[slot];
     memset(cmd_table, 0, sizeof(hba_cmd_table_t) + (cmd_header->prdtl - 1) * sizeof(hba_prdt_entry_t));
     
-    cmd_table->prdt_entry[0].dba = paging_virt_to_phys((uint32_t)buffer);
+    AHCI_SET_DMA_ADDR(cmd_table->prdt_entry[0].dba, cmd_table->prdt_entry[0].dbau,
+                      paging_virt_to_phys((uint32_t)buffer));
     cmd_table->prdt_entry[0].dbc = (count * 512) - 1;
     cmd_table->prdt_entry[0].i = 1;
     
@@ -430,6 +478,89 @@ int ahci_write(int port, uint64_t lba, uint16_t count, const void *buffer) {
     return 0;
 }
 
+/*
+ * Transfers count pages between consecutive sectors starting at lba and a
+ * list of physical frames, in a single command. Physically adjacent frames
+ * share one PRDT entry.
+ */
+static int ahci_rw_frames(int port, uint64_t lba, const uint32_t *frames, uint32_t count, int write) {
+    if (count == 0 || count > AHCI_MAX_PRDT) return -1;
+    hba_port_t *hba_port = ports[port];
+    hba_port->is = (uint32_t)-1;
+    
+    int slot = find_cmdslot(hba_port);
+    if (slot == -1) return -1;
+    
+    hba_cmd_header_t *cmd_header = (hba_cmd_header_t*)port_virt[port].clb;
+    cmd_header += slot;
+    
+    hba_cmd_table_t *cmd_table = (hba_cmd_table_t*)port_virt[port].ctba[slot];
+    memset(cmd_table, 0, sizeof(hba_cmd_table_t) + (AHCI_MAX_PRDT - 1) * sizeof(hba_prdt_entry_t));
+    
+    uint32_t prdts = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        hba_prdt_entry_t *prev = prdts ? &cmd_table->prdt_entry[prdts - 1] : NULL;
+        if (prev && prev->dba + prev->dbc + 1 == frames[i]) {
+            prev->dbc += PAGE_SIZE;
+            continue;
+        }
+        AHCI_SET_DMA_ADDR(cmd_table->prdt_entry[prdts].dba, cmd_table->prdt_entry[prdts].dbau,
+                          frames[i]);
+        cmd_table->prdt_entry[prdts].dbc = PAGE_SIZE - 1;
+        prdts++;
+    }
+    cmd_table->prdt_entry[prdts - 1].i = 1;
+    
+    cmd_header->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
+    cmd_header->w = write ? 1 : 0;
+    cmd_header->prdtl = (uint16_t)prdts;
+    
+    fis_reg_h2d_t *fis = (fis_reg_h2d_t*)(&cmd_table->cfis);
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->c = 1;
+    fis->command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    
+    fis->lba0 = (uint8_t)lba;
+    fis->lba1 = (uint8_t)(lba >> 8);
+    fis->lba2 = (uint8_t)(lba >> 16);
+    fis->device = 1 << 6;
+    
+    fis->lba3 = (uint8_t)(lba >> 24);
+    fis->lba4 = (uint8_t)(lba >> 32);
+    fis->lba5 = (uint8_t)(lba >> 40);
+    
+    fis->count = (uint16_t)(count * (PAGE_SIZE / 512));
+    
+    int spin = 0;
+    while ((hba_port->tfd & (ATA_SR_BSY | ATA_SR_DRQ)) && spin < 1000000) {
+        spin++;
+    }
+    if (spin == 1000000) {
+        console_write("AHCI: Port hung\n");
+        return -1;
+    }
+    
+    hba_port->ci = 1 << slot;
+    
+    while (1) {
+        if ((hba_port->ci & (1 << slot)) == 0) break;
+        if (hba_port->is & AHCI_PORT_IS_TFES) {
+            console_write(write ? "AHCI: Write error\n" : "AHCI: Read error\n");
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+int ahci_write_frames(int port, uint64_t lba, const uint32_t *frames, uint32_t count) {
+    return ahci_rw_frames(port, lba, frames, count, 1);
+}
+
+int ahci_read_frames(int port, uint64_t lba, const uint32_t *frames, uint32_t count) {
+    return ahci_rw_frames(port, lba, frames, count, 0);
+}
+
 // Block Device Interface Wrappers (Phase 7: Integration)
 static int ahci_block_read(block_device_t *dev, uint64_t sector, uint32_t count, void *buffer) {
     int port = (int)dev->driver_data;
@@ -497,6 +628,7 @@ void ahci_scan_ports(void) {
                     console_write("\n");
                     
                     stop_cmd(&abar->ports[i]);
+                    ahci_port_release(i);
                     port_status[i] = 0;
                 }
             }
@@ -4,6 +4,7 @@
 #include <ui/console.h>
 #include <mem/heap.h>
 #include <mem/paging.h>
+#include <mem/pmm.h>
 #include <string.h>
 
 // VirtIO Legacy PCI I/O Port Offsets
@@ -98,17 +99,21 @@ void virtqueue_init(virtio_device_t *dev) {
     size_t used_size = sizeof(vring_used_t);
     size_t total_size = desc_size + avail_size + used_size + 4096; // Add padding
     
-    // Allocate extra for alignment
-    void *vq_mem_raw = kmalloc(total_size + 4096);
-    if (!vq_mem_raw) {
+    // The device addresses the rings by a single PFN, so they must be
+    // physically contiguous: take a low-memory buddy block, reached through
+    // the physmap, rather than heap pages.
+    uint32_t order = 0;
+    while (((size_t)PAGE_SIZE << order) < total_size) {
+        order++;
+    }
+    uint32_t mem_phys = pmm_alloc_frames_zone(order, PMM_ZONE_NORMAL);
+    if (!mem_phys) {
         console_write("VirtIO: Failed to allocate virtqueue\n");
         return;
     }
-    
-    // Align to 4KB
-    uint32_t addr = (uint32_t)vq_mem_raw;
-    uint32_t aligned_addr = (addr + 4095) & ~4095;
-    void *vq_mem = (void *)aligned_addr;
+    void *vq_mem = phys_to_virt(mem_phys);
+    uint32_t old_phys = dev->vq.mem_phys;
+    uint32_t old_order = dev->vq.mem_order;
     
     memset(vq_mem, 0, total_size);
     
@@ -131,12 +136,15 @@ void virtqueue_init(virtio_device_t *dev) {
     }
     dev->vq.desc[queue_size - 1].next = 0;
     
-    // Get physical address
-    uint32_t phys_addr = paging_virt_to_phys((uint32_t)vq_mem);
-    uint32_t pfn = phys_addr >> 12;  // Page frame number
+    uint32_t pfn = mem_phys >> 12;  // Page frame number
     
     // Tell device about queue
     virtio_write32(dev, VIRTIO_PCI_QUEUE_ADDR, pfn);
+    dev->vq.mem_phys = mem_phys;
+    dev->vq.mem_order = order;
+    if (old_phys) {
+        pmm_free_frames(old_phys, old_order); // re-init: the device now uses the new rings
+    }
     
     console_write("VirtIO: Virtqueue initialized at PFN ");
     console_write_hex(pfn);
@@ -38,6 +38,13 @@ int virtio_console_init(void) {
     return 0;
 }
 
+/**
+ * Report whether the device is usable
+ */
+int virtio_console_available(void) {
+    return console_initialized;
+}
+
 /**
  * Write a single character to console
  */
@@ -2,9 +2,41 @@
 #include "fs/9p.h"
 #include "mem/heap.h"
 #include "mem/paging.h"
+#include "mem/pmm.h"
+#include "mem/vma.h"
 #include "ui/console.h"
 #include <string.h>
 
+#define ELF_MAP_CHUNK 16U /* frames gathered per paging_map_frames call */
+
+/*
+ * Adds a loaded segment to the current address space's areas. A page shared
+ * with the previous segment already belongs to that segment's area.
+ */
+static int record_segment(uint32_t start, uint32_t pages, uint32_t p_flags)
+{
+    vm_space_t *space = vma_current_space();
+    if (!space) {
+        return 0; // kernel-owned directory: no areas to keep
+    }
+    uint32_t end = start + pages * 0x1000;
+    const vma_t *prev = vma_find(space, start);
+    if (prev && prev->kind == VMA_ELF) {
+        start = prev->end;
+    }
+    if (start >= end) {
+        return 0;
+    }
+    uint32_t prot = VMA_READ;
+    if (p_flags & PF_W) {
+        prot |= VMA_WRITE;
+    }
+    if (p_flags & PF_X) {
+        prot |= VMA_EXEC;
+    }
+    return vma_insert(space, start, end - start, prot, VMA_ELF, 0);
+}
+
 // Validate ELF header
 int elf_validate(const void *data, uint32_t size)
 {
@@ -98,19 +130,42 @@ uint32_t elf_load(const char *path, uint32_t *entry_point)
             uint32_t memsz = phdr[i].p_memsz;
             uint32_t filesz = phdr[i].p_filesz;
             
-            // Allocate pages for this segment
-            uint32_t num_pages = (memsz + 0xFFF) / 0x1000;
-            for (uint32_t j = 0; j < num_pages; j++) {
+            // Allocate pages for this segment. User pages get frames of
+            // their own (heap pages belong to the heap), mapped writable
+            // until the segment is copied in.
+            // Runs of unmapped pages are gathered and mapped in one call.
+            uint32_t num_pages = ((vaddr & 0xFFF) + memsz + 0xFFF) / 0x1000;
+            if (record_segment(vaddr & 0xFFFFF000, num_pages, phdr[i].p_flags) != 0) {
+                console_write("[ELF] Segment overlaps an existing area\n");
+                kfree(file_data);
+                return 0;
+            }
+            uint32_t run_frames[ELF_MAP_CHUNK];
+            uint32_t run_start = 0;
+            uint32_t run_len = 0;
+            for (uint32_t j = 0; j <= num_pages; j++) {
                 uint32_t page_vaddr = (vaddr & 0xFFFFF000) + (j * 0x1000);
-                uint32_t page_phys = (uint32_t)kmalloc(0x1000);
-                
-                // Map as user-accessible
-                uint32_t flags = PAGE_PRESENT | PAGE_RW | PAGE_USER;
-                if (!(phdr[i].p_flags & PF_W)) {
-                    flags &= ~PAGE_RW; // Read-only if not writable
+                int mapped = (j == num_pages) || paging_virt_to_phys(page_vaddr) != 0;
+                if (run_len && (mapped || run_len == ELF_MAP_CHUNK)) {
+                    paging_map_frames(run_start, run_frames, run_len, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+                    run_len = 0;
+                }
+                if (mapped) {
+                    continue; // shared with the previous segment, or past the end
                 }
-                
-                paging_map(page_vaddr, paging_virt_to_phys(page_phys), flags);
+                uint32_t page_phys = pmm_alloc_zeroed_frame();
+                if (!page_phys) {
+                    console_write("[ELF] Out of memory\n");
+                    while (run_len-- > 0) {
+                        pmm_free_frame(run_frames[run_len]);
+                    }
+                    kfree(file_data);
+                    return 0;
+                }
+                if (!run_len) {
+                    run_start = page_vaddr;
+                }
+                run_frames[run_len++] = page_phys;
             }
 
             // Copy segment data
@@ -122,6 +177,11 @@ uint32_t elf_load(const char *path, uint32_t *entry_point)
             if (memsz > filesz) {
                 memset((void *)(vaddr + filesz), 0, memsz - filesz);
             }
+
+            // Read-only if not writable
+            if (!(phdr[i].p_flags & PF_W)) {
+                paging_protect_range(vaddr & 0xFFFFF000, num_pages, PAGE_USER);
+            }
         }
     }
 
@@ -17,8 +17,11 @@
 #include "mem/pmm.h"
 #include "mem/paging.h"
 #include "mem/heap.h"
+#include "mem/slab.h"
+#include "mem/vmalloc.h"
 #include "mem/swap.h"
 #include "mem/shm.h"
+#include "mem/kswapd.h"
 #include "sched/sched.h"
 #include "sys/syscall.h"
 #include "shell/shell.h"
@@ -62,6 +65,8 @@ void kernel_main(uint32_t magic, multiboot_info_t *mb_info)
     pmm_init(mb_info);
     paging_init();
     heap_init();
+    slab_init();
+    vmalloc_init();
     
     // Initialize PC speaker and play startup sound
     speaker_init();
@@ -86,6 +91,7 @@ void kernel_main(uint32_t magic, multiboot_info_t *mb_info)
     
     syscall_init();
     sched_init();
+    kswapd_init();
     
 
     // Initialize filesystem
@@ -98,6 +104,8 @@ void kernel_main(uint32_t magic, multiboot_info_t *mb_info)
 
     console_write("Shell exited. Halting.\n");
     for (;;) {
-        __asm__ volatile("hlt");
+        if (pmm_zero_pool_refill(8) == 0) {
+            __asm__ volatile("hlt");
+        }
     }
 }
@@ -25,6 +25,18 @@ static inline int32_t syscall1(int num, uint32_t arg1)
     return ret;
 }
 
+static inline int32_t syscall4(int num, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
+{
+    int32_t ret;
+    __asm__ volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (num), "b" (arg1), "c" (arg2), "d" (arg3), "S" (arg4)
+        : "memory"
+    );
+    return ret;
+}
+
 void exit(void)
 {
     syscall0(SYS_EXIT);
@@ -56,3 +68,23 @@ int exec(const char *path)
 {
     return syscall1(SYS_EXEC, (uint32_t)path);
 }
+
+int fork(void)
+{
+    return syscall0(SYS_FORK);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags)
+{
+    return (void *)syscall4(SYS_MMAP, (uint32_t)addr, (uint32_t)length, (uint32_t)prot, (uint32_t)flags);
+}
+
+int munmap(void *addr, size_t length)
+{
+    return syscall4(SYS_MUNMAP, (uint32_t)addr, (uint32_t)length, 0, 0);
+}
+
+int mprotect(void *addr, size_t length, int prot)
+{
+    return syscall4(SYS_MPROTECT, (uint32_t)addr, (uint32_t)length, (uint32_t)prot, 0);
+}
@@ -1,109 +1,318 @@
 #include "mem/heap.h"
 #include "mem/pmm.h"
 #include "mem/paging.h"
+#include "mem/slab.h"
+#include "mem/vmalloc.h"
+#include "mem/heap_profile.h"
 #include "ui/console.h"
 #include <string.h>
 
-#define HEAP_START (KERNEL_VIRT_BASE + 0x01000000) /* 0xC1000000 */
+#define HEAP_START 0xF0000000U /* above the physmap */
 #define HEAP_SIZE  (16 * 1024 * 1024)
+#define HEAP_LARGE (64U * 1024U)  /* requests from here up are page-mapped by vmalloc */
+#define HEAP_TRIM_THRESHOLD (128U * 1024U) /* default mapped slack above the top block before trimming */
+#define HEAP_TOP_PAD        (16U * 1024U)  /* slack a trim leaves mapped */
+#define HEAP_MAP_CHUNK      16U            /* frames gathered per paging_map_frames call */
 
+/*
+ * Two-level segregated fit (TLSF) heap.
+ *
+ * Every block starts with a boundary tag: a pointer to the physically
+ * preceding block and the payload size, whose low bits carry flags. Free
+ * blocks additionally keep free-list links in the first payload bytes.
+ *
+ * Free blocks are binned by size: the first level is the power of two, the
+ * second level splits each power of two into SL_COUNT equal ranges. Two
+ * bitmaps record which bins are non-empty, so finding a block that fits is
+ * a couple of bit scans and malloc/free never walk a list.
+ */
 typedef struct heap_block {
-    struct heap_block *next;
-    struct heap_block *prev;
-    size_t size;
-    int free;
+    struct heap_block *prev_phys;
+    size_t size;                  /* payload bytes | BLOCK_FREE */
+    struct heap_block *next_free; /* valid only while free */
+    struct heap_block *prev_free;
 } heap_block_t;
 
-#define BLOCK_OVERHEAD (sizeof(heap_block_t))
-#define MIN_SPLIT       32
+#define BLOCK_FREE      1U
+#define BLOCK_SIZE_MASK (~(size_t)7U)
+#define BLOCK_OVERHEAD  (2U * sizeof(uint32_t))  /* prev_phys + size */
+#define BLOCK_MIN_SIZE  (sizeof(heap_block_t) - BLOCK_OVERHEAD)
+
+#define ALIGN_SHIFT 3U
+#define SL_SHIFT    4U
+#define SL_COUNT    (1U << SL_SHIFT)
+#define FL_SHIFT    (SL_SHIFT + ALIGN_SHIFT)
+#define SMALL_BLOCK (1U << FL_SHIFT)              /* below this, fl is 0 and bins are 8 bytes apart */
+#define FL_COUNT    (24U - FL_SHIFT + 2U)          /* enough for a block spanning the whole heap */
 
 static uint32_t heap_curr = HEAP_START;
 static uint32_t heap_mapped_end = HEAP_START;
 static const uint32_t heap_end = HEAP_START + HEAP_SIZE;
-static heap_block_t *heap_head = NULL;
+static heap_block_t *heap_last = NULL; /* highest block; never free once kfree returns */
 static size_t allocated_bytes = 0;
+static uint32_t trim_threshold = HEAP_TRIM_THRESHOLD;
+static uint32_t pages_mapped = 0;
+static uint32_t pages_unmapped = 0;
 
-static void heap_trim(void);
-static heap_block_t *heap_tail(void);
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_COUNT];
+static heap_block_t *free_bins[FL_COUNT][SL_COUNT];
 
 static inline uint32_t align_up(uint32_t value, uint32_t align)
 {
     return (value + align - 1U) & ~(align - 1U);
 }
 
-static void map_new_page(uint32_t virt)
+static inline uint32_t fls(uint32_t word)
+{
+    return 31U - (uint32_t)__builtin_clz(word);
+}
+
+static inline uint32_t ffs(uint32_t word)
 {
-    uint32_t frame = pmm_alloc_frame();
+    return (uint32_t)__builtin_ctz(word);
+}
+
+static inline size_t block_size(const heap_block_t *block)
+{
+    return block->size & BLOCK_SIZE_MASK;
+}
+
+static inline int block_is_free(const heap_block_t *block)
+{
+    return (block->size & BLOCK_FREE) != 0;
+}
+
+static inline heap_block_t *block_next(heap_block_t *block)
+{
+    if (block == heap_last) {
+        return NULL;
+    }
+    return (heap_block_t *)((uint8_t *)block + BLOCK_OVERHEAD + block_size(block));
+}
+
+static inline void *block_payload(heap_block_t *block)
+{
+    return (uint8_t *)block + BLOCK_OVERHEAD;
+}
+
+static void mapping_insert(size_t size, uint32_t *fl, uint32_t *sl)
+{
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (uint32_t)size >> ALIGN_SHIFT;
+    } else {
+        uint32_t bit = fls((uint32_t)size);
+        *sl = ((uint32_t)size >> (bit - SL_SHIFT)) ^ SL_COUNT;
+        *fl = bit - FL_SHIFT + 1U;
+    }
+}
+
+/* Like mapping_insert, but rounds up so any block in the bin is big enough. */
+static void mapping_search(size_t size, uint32_t *fl, uint32_t *sl)
+{
+    if (size >= SMALL_BLOCK) {
+        size += (1U << (fls((uint32_t)size) - SL_SHIFT)) - 1U;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void free_list_insert(heap_block_t *block)
+{
+    uint32_t fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    block->prev_free = NULL;
+    block->next_free = free_bins[fl][sl];
+    if (block->next_free) {
+        block->next_free->prev_free = block;
+    }
+    free_bins[fl][sl] = block;
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+static void free_list_remove(heap_block_t *block)
+{
+    uint32_t fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        free_bins[fl][sl] = block->next_free;
+        if (!free_bins[fl][sl]) {
+            sl_bitmap[fl] &= ~(1U << sl);
+            if (!sl_bitmap[fl]) {
+                fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+}
+
+static heap_block_t *find_free_block(size_t size)
+{
+    uint32_t fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= FL_COUNT) {
+        return NULL;
+    }
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1U < 32U) ? fl_bitmap & (~0U << (fl + 1U)) : 0;
+        if (!fl_map) {
+            return NULL;
+        }
+        fl = ffs(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    return free_bins[fl][ffs(sl_map)];
+}
+
+static uint32_t alloc_heap_frame(void)
+{
+    uint32_t frame = pmm_alloc_zeroed_frame();
     if (frame == 0) {
         console_write("kmalloc: out of frames\n");
         for (;;) {
             __asm__ volatile ("cli; hlt");
         }
     }
-    paging_map(virt, frame, PAGE_RW | PAGE_PRESENT);
-    memset((void *)virt, 0, PAGE_SIZE);
+    return frame;
 }
 
 static void ensure_space(uint32_t target_end)
 {
+    uint32_t frames[HEAP_MAP_CHUNK];
     while (heap_mapped_end < target_end) {
-        map_new_page(heap_mapped_end);
-        heap_mapped_end += PAGE_SIZE;
+        uint32_t count = 0;
+        while (count < HEAP_MAP_CHUNK && heap_mapped_end + count * PAGE_SIZE < target_end) {
+            frames[count++] = alloc_heap_frame();
+        }
+        paging_map_frames(heap_mapped_end, frames, count, PAGE_RW | PAGE_PRESENT | PAGE_GLOBAL);
+        heap_mapped_end += count * PAGE_SIZE;
+        pages_mapped += count;
     }
 }
 
+/* Appends a block of size payload bytes at the top of the heap. */
 static heap_block_t *request_block(size_t size)
 {
-    uint32_t start = align_up(heap_curr, sizeof(uint32_t));
-    uint32_t total = start + (uint32_t)size;
-    if (total + BLOCK_OVERHEAD > heap_end) {
+    uint32_t start = heap_curr;
+    if ((uint64_t)start + BLOCK_OVERHEAD + size > heap_end) {
         return NULL;
     }
-    ensure_space(total + BLOCK_OVERHEAD);
+    ensure_space(start + BLOCK_OVERHEAD + (uint32_t)size);
     heap_block_t *block = (heap_block_t *)start;
-    block->next = NULL;
-    block->prev = NULL;
+    block->prev_phys = heap_last;
     block->size = size;
-    block->free = 0;
-    heap_curr = total + BLOCK_OVERHEAD;
+    heap_last = block;
+    heap_curr = start + BLOCK_OVERHEAD + (uint32_t)size;
     return block;
 }
 
-static void split_block(heap_block_t *block, size_t requested)
+static void heap_trim(heap_block_t *last);
+
+/* Gives the tail of block beyond size back to the free lists. */
+static void split_block(heap_block_t *block, size_t size)
 {
-    size_t remaining = block->size - requested;
-    if (remaining <= BLOCK_OVERHEAD + MIN_SPLIT) {
+    size_t remaining = block_size(block) - size;
+    if (remaining < BLOCK_OVERHEAD + BLOCK_MIN_SIZE) {
         return;
     }
-    uint32_t new_addr = (uint32_t)((uint8_t *)block + BLOCK_OVERHEAD + requested);
-    heap_block_t *new_block = (heap_block_t *)new_addr;
-    new_block->size = remaining - BLOCK_OVERHEAD;
-    new_block->free = 1;
-    new_block->next = block->next;
-    new_block->prev = block;
-    if (new_block->next) {
-        new_block->next->prev = new_block;
+    heap_block_t *next = block_next(block);
+    heap_block_t *rest = (heap_block_t *)((uint8_t *)block + BLOCK_OVERHEAD + size);
+    rest->prev_phys = block;
+    rest->size = (remaining - BLOCK_OVERHEAD) | BLOCK_FREE;
+    block->size = size | (block->size & BLOCK_FREE);
+    if (!next) {
+        heap_last = rest;
+        heap_trim(rest);
+        return;
     }
-    block->next = new_block;
-    block->size = requested;
+    next->prev_phys = rest;
+    free_list_insert(rest);
 }
 
-static void coalesce(heap_block_t *block)
+/*
+ * Splits gap bytes off the front of an in-use block and frees them. The
+ * block before is never free (free neighbours are always merged), so the
+ * gap goes straight into its bin. Returns the block that now starts at
+ * block + gap.
+ */
+static heap_block_t *split_front(heap_block_t *block, size_t gap)
 {
-    if (block->next && block->next->free) {
-        heap_block_t *next = block->next;
-        block->size += BLOCK_OVERHEAD + next->size;
-        block->next = next->next;
-        if (block->next) {
-            block->next->prev = block;
+    heap_block_t *next = block_next(block);
+    heap_block_t *rest = (heap_block_t *)((uint8_t *)block + gap);
+    rest->prev_phys = block;
+    rest->size = block_size(block) - gap;
+    block->size = (gap - BLOCK_OVERHEAD) | BLOCK_FREE;
+    if (next) {
+        next->prev_phys = rest;
+    } else {
+        heap_last = rest;
+    }
+    free_list_insert(block);
+    return rest;
+}
+
+/* Merges block with its free physical neighbours; returns the merged block. */
+static heap_block_t *coalesce(heap_block_t *block)
+{
+    heap_block_t *next = block_next(block);
+    if (next && block_is_free(next)) {
+        free_list_remove(next);
+        block->size += BLOCK_OVERHEAD + block_size(next);
+        if (next == heap_last) {
+            heap_last = block;
+        } else {
+            block_next(block)->prev_phys = block;
         }
     }
-    if (block->prev && block->prev->free) {
-        block->prev->size += BLOCK_OVERHEAD + block->size;
-        block->prev->next = block->next;
-        if (block->next) {
-            block->next->prev = block->prev;
+    heap_block_t *prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        free_list_remove(prev);
+        prev->size += BLOCK_OVERHEAD + block_size(block);
+        if (block == heap_last) {
+            heap_last = prev;
+        } else {
+            block_next(prev)->prev_phys = prev;
         }
+        block = prev;
+    }
+    return block;
+}
+
+/* Unmaps heap pages from the mapped end down to target. Returns the count. */
+static uint32_t unmap_down_to(uint32_t target)
+{
+    if (heap_mapped_end <= target) {
+        return 0;
+    }
+    uint32_t released = (heap_mapped_end - target) / PAGE_SIZE;
+    paging_unmap_range(target, released, 1);
+    heap_mapped_end = target;
+    pages_unmapped += released;
+    return released;
+}
+
+/*
+ * Called when the highest block became free: drop it, lowering the top of
+ * the heap. The pages above stay mapped for the next request unless the
+ * slack has grown past the trim threshold, and then a trim still keeps
+ * HEAP_TOP_PAD so an alloc/free loop around the boundary doesn't remap on
+ * every call. Coalescing guarantees the block below is in use, so this
+ * never loops.
+ */
+static void heap_trim(heap_block_t *last)
+{
+    heap_last = last->prev_phys;
+    heap_curr = (uint32_t)last;
+
+    uint32_t top = align_up(heap_curr, PAGE_SIZE);
+    if (heap_mapped_end - top > trim_threshold) {
+        unmap_down_to(top + HEAP_TOP_PAD);
     }
 }
 
@@ -111,58 +320,126 @@ void heap_init(void)
 {
     heap_curr = HEAP_START;
     heap_mapped_end = HEAP_START;
-    heap_head = NULL;
+    heap_last = NULL;
     allocated_bytes = 0;
+    pages_mapped = 0;
+    pages_unmapped = 0;
+    fl_bitmap = 0;
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    memset(free_bins, 0, sizeof(free_bins));
+    paging_reserve_kernel_tables(HEAP_START, HEAP_SIZE);
     console_write("Kernel heap ready.\n");
 }
 
-void *kmalloc(size_t size)
+static void *heap_alloc(size_t size)
 {
     if (size == 0) {
         return NULL;
     }
-    size = align_up((uint32_t)size, sizeof(uint32_t));
-    heap_block_t *block = heap_head;
-    while (block) {
-        if (block->free && block->size >= size) {
-            block->free = 0;
-            split_block(block, size);
-            return (uint8_t *)block + BLOCK_OVERHEAD;
+    kmem_cache_t *cache = kmalloc_cache(size);
+    if (cache) {
+        void *obj = kmem_cache_alloc(cache);
+        if (obj) {
+            return obj;
         }
-        block = block->next;
     }
-    block = request_block(size);
-    if (!block) {
+    if (size >= HEAP_LARGE) {
+        return vmalloc(size);
+    }
+    size = align_up((uint32_t)size, 1U << ALIGN_SHIFT);
+    if (size < BLOCK_MIN_SIZE) {
+        size = BLOCK_MIN_SIZE;
+    }
+
+    heap_block_t *block = find_free_block(size);
+    if (block) {
+        free_list_remove(block);
+        block->size &= ~BLOCK_FREE;
+        split_block(block, size);
+    } else {
+        block = request_block(size);
+        if (!block) {
+            return NULL;
+        }
+    }
+    allocated_bytes += block_size(block);
+    return block_payload(block);
+}
+
+static void *heap_alloc_aligned(size_t size, size_t alignment)
+{
+    if (size == 0 || (alignment & (alignment - 1U))) {
+        return NULL;
+    }
+    if (alignment <= (1U << ALIGN_SHIFT)) {
+        return heap_alloc(size);
+    }
+    /* Power-of-two slab objects are aligned to their own size. */
+    kmem_cache_t *cache = kmalloc_cache(size < alignment ? alignment : size);
+    if (cache) {
+        void *obj = kmem_cache_alloc(cache);
+        if (obj) {
+            return obj;
+        }
+    }
+    /* vmalloc areas start on a page boundary. */
+    if (size >= HEAP_LARGE && alignment <= PAGE_SIZE) {
+        return vmalloc(size);
+    }
+    if (size > HEAP_SIZE || alignment > HEAP_SIZE) {
         return NULL;
     }
-    if (!heap_head) {
-        heap_head = block;
+    size = align_up((uint32_t)size, 1U << ALIGN_SHIFT);
+    if (size < BLOCK_MIN_SIZE) {
+        size = BLOCK_MIN_SIZE;
+    }
+
+    /*
+     * Take a block with room for the worst-case leading gap. The gap must be
+     * either empty or large enough to stand as a free block of its own.
+     */
+    size_t search = size + alignment + BLOCK_OVERHEAD + BLOCK_MIN_SIZE;
+    heap_block_t *block = find_free_block(search);
+    if (block) {
+        free_list_remove(block);
+        block->size &= ~BLOCK_FREE;
     } else {
-        heap_block_t *tail = heap_head;
-        while (tail->next) {
-            tail = tail->next;
+        block = request_block(search);
+        if (!block) {
+            return NULL;
         }
-        tail->next = block;
-        block->prev = tail;
     }
-    allocated_bytes += block->size;
-    return (void *)((uint8_t *)block + BLOCK_OVERHEAD);
+
+    uint32_t payload = (uint32_t)block_payload(block);
+    uint32_t aligned = align_up(payload, (uint32_t)alignment);
+    if (aligned != payload) {
+        if (aligned - payload < BLOCK_OVERHEAD + BLOCK_MIN_SIZE) {
+            aligned += (uint32_t)alignment;
+        }
+        block = split_front(block, aligned - payload);
+    }
+    split_block(block, size);
+    allocated_bytes += block_size(block);
+    return block_payload(block);
+}
+
+/* With HEAP_PROFILE, every allocation is charged to the caller of kmalloc. */
+void *kmalloc(size_t size)
+{
+    void *ptr = heap_alloc(size);
+#ifdef HEAP_PROFILE
+    heap_profile_record(ptr, size, __builtin_return_address(0));
+#endif
+    return ptr;
 }
 
-void *kmalloc_aligned(size_t size, size_t alignment) {
-    // Simple implementation: allocate extra space and return aligned pointer
-    // Note: This is wasteful and doesn't handle freeing correctly for now
-    // (kfree assumes the pointer points to the block header)
-    // For AHCI initialization which is done once, this is acceptable.
-    
-    void *ptr = kmalloc(size + alignment + BLOCK_OVERHEAD);
-    if (!ptr) return NULL;
-    
-    uint32_t addr = (uint32_t)ptr;
-    uint32_t aligned_addr = (addr + alignment - 1) & ~(alignment - 1);
-    
-    // We're leaking the padding bytes here, but for static driver structures it's fine
-    return (void *)aligned_addr;
+void *kmalloc_aligned(size_t size, size_t alignment)
+{
+    void *ptr = heap_alloc_aligned(size, alignment);
+#ifdef HEAP_PROFILE
+    heap_profile_record(ptr, size, __builtin_return_address(0));
+#endif
+    return ptr;
 }
 
 void kfree(void *ptr)
@@ -170,15 +447,35 @@ void kfree(void *ptr)
     if (!ptr) {
         return;
     }
+#ifdef HEAP_PROFILE
+    heap_profile_forget(ptr);
+#endif
+    kmem_cache_t *cache = slab_cache_of(ptr);
+    if (cache) {
+        kmem_cache_free(cache, ptr);
+        return;
+    }
+    if (is_vmalloc_addr(ptr)) {
+        vfree(ptr);
+        return;
+    }
+    if ((uint32_t)ptr < HEAP_START + BLOCK_OVERHEAD || (uint32_t)ptr >= heap_curr) {
+        console_write("kfree: pointer outside the heap\n");
+        return;
+    }
     heap_block_t *block = (heap_block_t *)((uint8_t *)ptr - BLOCK_OVERHEAD);
-    if (block->free) {
+    if (block_is_free(block)) {
         console_write("kfree: double free detected\n");
         return;
     }
-    block->free = 1;
-    allocated_bytes -= block->size;
-    coalesce(block);
-    heap_trim();
+    allocated_bytes -= block_size(block);
+    block->size |= BLOCK_FREE;
+    block = coalesce(block);
+    if (block == heap_last) {
+        heap_trim(block);
+    } else {
+        free_list_insert(block);
+    }
 }
 
 size_t heap_bytes_in_use(void)
@@ -191,46 +488,20 @@ size_t heap_bytes_free(void)
     return (size_t)(heap_mapped_end - HEAP_START) - allocated_bytes;
 }
 
-static heap_block_t *heap_tail(void)
+uint32_t heap_release_slack(void)
 {
-    heap_block_t *tail = heap_head;
-    if (!tail) {
-        return NULL;
-    }
-    while (tail->next) {
-        tail = tail->next;
-    }
-    return tail;
+    return unmap_down_to(align_up(heap_curr, PAGE_SIZE));
 }
 
-static void heap_trim(void)
+void heap_set_trim_threshold(size_t bytes)
 {
-    while (1) {
-        heap_block_t *tail = heap_tail();
-        if (!tail) {
-            heap_curr = HEAP_START;
-            break;
-        }
-        uint32_t tail_start = (uint32_t)tail;
-        if (!tail->free) {
-            heap_curr = tail_start + BLOCK_OVERHEAD + tail->size;
-            break;
-        }
-        if (tail->prev) {
-            tail->prev->next = NULL;
-        } else {
-            heap_head = NULL;
-        }
-        heap_curr = tail_start;
-    }
+    trim_threshold = align_up((uint32_t)bytes, PAGE_SIZE);
+}
 
-    uint32_t target = align_up(heap_curr, PAGE_SIZE);
-    while (heap_mapped_end > target) {
-        heap_mapped_end -= PAGE_SIZE;
-        uint32_t phys = paging_virt_to_phys(heap_mapped_end);
-        paging_unmap(heap_mapped_end);
-        if (phys) {
-            pmm_free_frame(phys);
-        }
-    }
+void heap_get_stats(heap_stats_t *out)
+{
+    out->pages_mapped = pages_mapped;
+    out->pages_unmapped = pages_unmapped;
+    out->slack_pages = (heap_mapped_end - align_up(heap_curr, PAGE_SIZE)) / PAGE_SIZE;
+    out->trim_threshold = trim_threshold;
 }
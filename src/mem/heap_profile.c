@@ -0,0 +1,205 @@
+#include "mem/heap_profile.h"
+
+#ifdef HEAP_PROFILE
+#include "arch/x86/cpu.h"
+#include "arch/x86/timer.h"
+
+/*
+ * Live allocations sit in an open-addressed table keyed by pointer (linear
+ * probing, backward-shift deletion, so there are no tombstones). Call sites
+ * are a second table keyed by return address; sites are never removed.
+ * Recording stops at LIVE_LIMIT (3/4 full): the table always keeps empty
+ * slots, so every probe run ends, and runs stay short.
+ */
+#define LIVE_LIMIT (HEAP_PROFILE_MAX_LIVE / 4U * 3U)
+
+static heap_record_t live[HEAP_PROFILE_MAX_LIVE];
+static heap_site_t sites[HEAP_PROFILE_MAX_SITES];
+static heap_profile_summary_t summary;
+
+static uint32_t hash(uint32_t key, uint32_t slots)
+{
+    return ((key >> 3) * 2654435761U) & (slots - 1U);
+}
+
+static uint32_t bucket_of(uint32_t size)
+{
+    uint32_t bucket = size ? 31U - (uint32_t)__builtin_clz(size) : 0;
+    return bucket < HEAP_PROFILE_BUCKETS ? bucket : HEAP_PROFILE_BUCKETS - 1U;
+}
+
+static heap_site_t *site_lookup(uint32_t caller, int create)
+{
+    uint32_t i = hash(caller, HEAP_PROFILE_MAX_SITES);
+    for (uint32_t n = 0; n < HEAP_PROFILE_MAX_SITES; ++n) {
+        heap_site_t *site = &sites[i];
+        if (site->caller == caller) {
+            return site;
+        }
+        if (site->caller == 0) {
+            if (!create) {
+                return NULL;
+            }
+            site->caller = caller;
+            ++summary.sites;
+            return site;
+        }
+        i = (i + 1U) & (HEAP_PROFILE_MAX_SITES - 1U);
+    }
+    return NULL;
+}
+
+void heap_profile_record(void *ptr, size_t size, void *caller)
+{
+    if (!ptr) {
+        return;
+    }
+    uint32_t irq = cpu_save_irq();
+    heap_site_t *site = site_lookup((uint32_t)caller, 1);
+    if (site) {
+        ++site->allocs;
+        site->alloc_bytes += size;
+    } else {
+        ++summary.unattributed;
+    }
+    ++summary.alloc_hist[bucket_of(size)];
+
+    if (summary.live_count >= LIVE_LIMIT) {
+        ++summary.dropped;
+        cpu_restore_irq(irq);
+        return;
+    }
+    uint32_t i = hash((uint32_t)ptr, HEAP_PROFILE_MAX_LIVE);
+    while (live[i].ptr) {
+        i = (i + 1U) & (HEAP_PROFILE_MAX_LIVE - 1U);
+    }
+    live[i].ptr = (uint32_t)ptr;
+    live[i].caller = (uint32_t)caller;
+    live[i].size = size;
+    live[i].stamp = (uint32_t)timer_ticks();
+    ++summary.live_count;
+    summary.live_bytes += size;
+    ++summary.live_hist[bucket_of(size)];
+    if (site) {
+        ++site->live_count;
+        site->live_bytes += size;
+    }
+    cpu_restore_irq(irq);
+}
+
+void heap_profile_forget(void *ptr)
+{
+    uint32_t irq = cpu_save_irq();
+    uint32_t i = hash((uint32_t)ptr, HEAP_PROFILE_MAX_LIVE);
+    for (uint32_t n = 0; live[i].ptr && live[i].ptr != (uint32_t)ptr; ++n) {
+        if (n == HEAP_PROFILE_MAX_LIVE) {
+            cpu_restore_irq(irq);
+            return;
+        }
+        i = (i + 1U) & (HEAP_PROFILE_MAX_LIVE - 1U);
+    }
+    if (!live[i].ptr) {
+        cpu_restore_irq(irq);
+        return; /* allocated before the table had room, or not from kmalloc */
+    }
+
+    heap_record_t *rec = &live[i];
+    --summary.live_count;
+    summary.live_bytes -= rec->size;
+    --summary.live_hist[bucket_of(rec->size)];
+    heap_site_t *site = site_lookup(rec->caller, 0);
+    if (site) {
+        --site->live_count;
+        site->live_bytes -= rec->size;
+    }
+
+    /* Backward-shift: pull later entries of the probe run into the hole. */
+    uint32_t hole = i;
+    for (uint32_t j = (i + 1U) & (HEAP_PROFILE_MAX_LIVE - 1U); live[j].ptr;
+         j = (j + 1U) & (HEAP_PROFILE_MAX_LIVE - 1U)) {
+        uint32_t home = hash(live[j].ptr, HEAP_PROFILE_MAX_LIVE);
+        if (((j - home) & (HEAP_PROFILE_MAX_LIVE - 1U)) >=
+            ((j - hole) & (HEAP_PROFILE_MAX_LIVE - 1U))) {
+            live[hole] = live[j];
+            hole = j;
+        }
+    }
+    live[hole].ptr = 0;
+    cpu_restore_irq(irq);
+}
+
+int heap_profile_summary(heap_profile_summary_t *out)
+{
+    uint32_t irq = cpu_save_irq();
+    *out = summary;
+    cpu_restore_irq(irq);
+    return 0;
+}
+
+int heap_profile_site(uint32_t index, heap_site_t *out)
+{
+    for (uint32_t i = 0; i < HEAP_PROFILE_MAX_SITES; ++i) {
+        if (!sites[i].caller) {
+            continue;
+        }
+        if (index-- != 0) {
+            continue;
+        }
+        uint32_t irq = cpu_save_irq();
+        *out = sites[i];
+        cpu_restore_irq(irq);
+        return 0;
+    }
+    return -1;
+}
+
+int heap_profile_next_live(uint32_t *cursor, heap_record_t *out)
+{
+    while (*cursor < HEAP_PROFILE_MAX_LIVE) {
+        uint32_t i = (*cursor)++;
+        uint32_t irq = cpu_save_irq();
+        if (live[i].ptr) {
+            *out = live[i];
+            cpu_restore_irq(irq);
+            return 0;
+        }
+        cpu_restore_irq(irq);
+    }
+    return -1;
+}
+
+#else
+
+void heap_profile_record(void *ptr, size_t size, void *caller)
+{
+    (void)ptr;
+    (void)size;
+    (void)caller;
+}
+
+void heap_profile_forget(void *ptr)
+{
+    (void)ptr;
+}
+
+int heap_profile_summary(heap_profile_summary_t *out)
+{
+    (void)out;
+    return -1;
+}
+
+int heap_profile_site(uint32_t index, heap_site_t *out)
+{
+    (void)index;
+    (void)out;
+    return -1;
+}
+
+int heap_profile_next_live(uint32_t *cursor, heap_record_t *out)
+{
+    (void)cursor;
+    (void)out;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "mem/kswapd.h"
+#include "mem/pmm.h"
+#include "mem/paging.h"
+#include "mem/swap.h"
+#include "sched/sched.h"
+#include "ui/console.h"
+#include "arch/x86/cpu.h"
+
+#define KSWAPD_BATCH SWAP_BATCH_MAX /* pages per pass: one full swap write */
+#define ZONE_NONE    PMM_ZONE_COUNT
+
+static int32_t kswapd_pid = -1;
+static volatile uint32_t wanted_zone = ZONE_NONE; /* most constrained zone asked for */
+static uint32_t wakeups = 0;
+static uint32_t reclaimed = 0;
+
+/*
+ * Runs until every zone it was woken for is back above its high
+ * watermark, then sleeps. Reclaim happens in short passes, each with
+ * interrupts off inside paging_reclaim(), so allocations and faults on
+ * other tasks see the LRU and page tables consistent between passes.
+ */
+static void kswapd_main(void)
+{
+    for (;;) {
+        uint32_t irq = cpu_save_irq();
+        uint32_t zone = wanted_zone;
+        wanted_zone = ZONE_NONE;
+        cpu_restore_irq(irq);
+
+        while (zone != ZONE_NONE && swap_available() &&
+               !pmm_watermark_ok(zone, PMM_WMARK_HIGH)) {
+            uint32_t freed = paging_reclaim(zone, KSWAPD_BATCH);
+            reclaimed += freed;
+            if (!freed) {
+                break; // nothing cold enough yet; wait for the next wake
+            }
+        }
+        if (wanted_zone == ZONE_NONE) {
+            sched_sleep(); // returns at once if a wake lands after the check
+        }
+    }
+}
+
+void kswapd_init(void)
+{
+    kswapd_pid = sched_spawn_kernel(kswapd_main, "kswapd");
+    if (kswapd_pid < 0) {
+        console_write("kswapd: no task slot, reclaim stays synchronous\n");
+    }
+}
+
+void kswapd_wake(uint32_t zone)
+{
+    if (kswapd_pid < 0) {
+        return;
+    }
+    if (zone < wanted_zone) {
+        wanted_zone = zone;
+    }
+    if (sched_wake((uint32_t)kswapd_pid)) {
+        ++wakeups;
+    }
+}
+
+void kswapd_stats(uint32_t *wakeups_out, uint32_t *reclaimed_out)
+{
+    *wakeups_out = wakeups;
+    *reclaimed_out = reclaimed;
+}
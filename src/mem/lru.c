@@ -0,0 +1,111 @@
+#include "mem/lru.h"
+#include "arch/x86/cpu.h"
+#include <stddef.h>
+
+#define FRAME_SHIFT 12U
+
+/*
+ * Lists run head (most recent) to tail (coldest). Links are frame numbers,
+ * as everywhere in page_t: next points towards the tail, prev towards the
+ * head, and 0 ends the list.
+ */
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t count;
+} lru_list_t;
+
+static lru_list_t lists[2];
+
+static inline uint32_t frame_of(const page_t *page)
+{
+    return pmm_page_addr(page) >> FRAME_SHIFT;
+}
+
+static inline page_t *page_of(uint32_t frame)
+{
+    return pmm_page(frame << FRAME_SHIFT);
+}
+
+static void link_head(lru_list_t *list, page_t *page)
+{
+    uint32_t frame = frame_of(page);
+    page->prev = 0;
+    page->next = list->head;
+    if (list->head) {
+        page_of(list->head)->prev = frame;
+    } else {
+        list->tail = frame;
+    }
+    list->head = frame;
+    ++list->count;
+}
+
+static void unlink(lru_list_t *list, page_t *page)
+{
+    if (page->prev) {
+        page_of(page->prev)->next = page->next;
+    } else {
+        list->head = page->next;
+    }
+    if (page->next) {
+        page_of(page->next)->prev = page->prev;
+    } else {
+        list->tail = page->prev;
+    }
+    page->next = 0;
+    page->prev = 0;
+    --list->count;
+}
+
+static inline lru_list_t *list_of(const page_t *page)
+{
+    return &lists[(page->flags & PG_ACTIVE) ? LRU_ACTIVE : LRU_INACTIVE];
+}
+
+void lru_add(page_t *page)
+{
+    uint32_t irq = cpu_save_irq();
+    if (!(page->flags & PG_LRU)) {
+        page->flags |= PG_LRU;
+        page->flags &= ~PG_ACTIVE;
+        link_head(&lists[LRU_INACTIVE], page);
+    }
+    cpu_restore_irq(irq);
+}
+
+void lru_del(page_t *page)
+{
+    uint32_t irq = cpu_save_irq();
+    if (page->flags & PG_LRU) {
+        unlink(list_of(page), page);
+        page->flags &= ~(PG_LRU | PG_ACTIVE);
+    }
+    cpu_restore_irq(irq);
+}
+
+void lru_move(page_t *page, int list)
+{
+    uint32_t irq = cpu_save_irq();
+    if (page->flags & PG_LRU) {
+        unlink(list_of(page), page);
+        if (list == LRU_ACTIVE) {
+            page->flags |= PG_ACTIVE;
+        } else {
+            page->flags &= ~PG_ACTIVE;
+        }
+        link_head(&lists[list], page);
+    }
+    cpu_restore_irq(irq);
+}
+
+page_t *lru_tail(int list)
+{
+    uint32_t frame = lists[list].tail;
+    return frame ? page_of(frame) : NULL;
+}
+
+uint32_t lru_count(int list)
+{
+    return lists[list].count;
+}
@@ -0,0 +1,116 @@
+#include "mem/memblock.h"
+#include "ui/console.h"
+
+typedef struct {
+    uint32_t count;
+    memblock_range_t ranges[MEMBLOCK_MAX_RANGES];
+} memblock_type_t;
+
+static memblock_type_t memory;
+static memblock_type_t reserved;
+
+/* Inserts [base, end) keeping the list sorted, merging overlapping or touching ranges. */
+static void range_insert(memblock_type_t *type, uint64_t base, uint64_t end)
+{
+    if (base >= end) {
+        return;
+    }
+
+    uint32_t i = 0;
+    while (i < type->count && type->ranges[i].end < base) {
+        ++i;
+    }
+    /* Absorb every range that overlaps or touches the new one. */
+    uint32_t j = i;
+    while (j < type->count && type->ranges[j].base <= end) {
+        if (type->ranges[j].base < base) {
+            base = type->ranges[j].base;
+        }
+        if (type->ranges[j].end > end) {
+            end = type->ranges[j].end;
+        }
+        ++j;
+    }
+
+    if (j == i) {
+        if (type->count == MEMBLOCK_MAX_RANGES) {
+            console_write("memblock: range table full, dropping ");
+            console_write_hex((uint32_t)base);
+            console_write("\n");
+            return;
+        }
+        for (uint32_t k = type->count; k > i; --k) {
+            type->ranges[k] = type->ranges[k - 1];
+        }
+        ++type->count;
+    } else if (j > i + 1) {
+        uint32_t removed = j - i - 1;
+        for (uint32_t k = i + 1; k + removed < type->count; ++k) {
+            type->ranges[k] = type->ranges[k + removed];
+        }
+        type->count -= removed;
+    }
+    type->ranges[i].base = base;
+    type->ranges[i].end = end;
+}
+
+void memblock_add(uint64_t base, uint64_t size)
+{
+    range_insert(&memory, base, base + size);
+}
+
+void memblock_reserve(uint64_t base, uint64_t size)
+{
+    range_insert(&reserved, base, base + size);
+}
+
+int memblock_next_free(uint64_t *pos, uint64_t *base, uint64_t *end)
+{
+    for (uint32_t i = 0; i < memory.count; ++i) {
+        uint64_t start = memory.ranges[i].base > *pos ? memory.ranges[i].base : *pos;
+        uint64_t limit = memory.ranges[i].end;
+        /* Reserved ranges are sorted and disjoint: skip those covering start,
+         * then the next one (if any) bounds the gap. */
+        for (uint32_t r = 0; r < reserved.count && start < limit; ++r) {
+            if (reserved.ranges[r].end <= start) {
+                continue;
+            }
+            if (reserved.ranges[r].base <= start) {
+                start = reserved.ranges[r].end;
+                continue;
+            }
+            if (reserved.ranges[r].base < limit) {
+                limit = reserved.ranges[r].base;
+            }
+            break;
+        }
+        if (start < limit) {
+            *base = start;
+            *end = limit;
+            *pos = limit;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t memblock_alloc(uint32_t size, uint32_t align, uint32_t limit)
+{
+    uint64_t pos = 0, base, end;
+    while (memblock_next_free(&pos, &base, &end)) {
+        uint64_t start = (base + align - 1U) & ~(uint64_t)(align - 1U);
+        if (end > limit) {
+            end = limit;
+        }
+        if (start + size <= end) {
+            memblock_reserve(start, size);
+            return (uint32_t)start;
+        }
+    }
+    return 0;
+}
+
+uint64_t memblock_end_of_ram(void)
+{
+    return memory.count ? memory.ranges[memory.count - 1].end : 0;
+}
@@ -1,15 +1,77 @@
 #include "mem/paging.h"
 #include "mem/pmm.h"
+#include "mem/heap.h"
+#include "mem/swap.h"
+#include "mem/memblock.h"
+#include "mem/lru.h"
+#include "mem/kswapd.h"
+#include "mem/vma.h"
+#include "sched/sched.h"
 #include "ui/console.h"
+#include "ui/framebuffer.h"
 #include <string.h>
 #include "arch/x86/interrupts.h"
+#include "arch/x86/cpu.h"
 
 #define PAGE_TABLE_ENTRIES 1024
 #define PAGE_DIRECTORY_ENTRIES 1024
 #define PAGE_TABLE_SIZE (PAGE_TABLE_ENTRIES * sizeof(uint32_t))
+#define IDENTITY_LIMIT (16U * 1024U * 1024U)
+#define IDENTITY_PDES  (IDENTITY_LIMIT >> 22) /* directory slots of the identity map, shared by every directory */
+#define USER_PDES      (KERNEL_VIRT_BASE >> 22)
+#define LARGE_PAGE_SIZE 0x400000U
+#define MMIO_VIRT    0xFA000000U /* device windows, up to the scratch slots */
+#define SCRATCH_VIRT 0xFF800000U /* two-page window for frames outside the physmap */
+#define CPUID_EDX_PSE (1U << 3)
+#define CPUID_EDX_PGE (1U << 13)
+#define CR4_PSE       0x00000010U
+#define CR4_PGE       0x00000080U
 
+/*
+ * Page directories and tables are read and written through phys_to_ptr(),
+ * which goes through the physmap (all of low memory, linear at
+ * KERNEL_VIRT_BASE), so they come from ZONE_NORMAL or below. Data pages are
+ * only touched through their mappings (or the physmap/scratch window) and
+ * may come from any zone.
+ */
+#define TABLE_ZONE PMM_ZONE_NORMAL
+#define PAGE_ZONE  PMM_ZONE_HIGH
+#define RECLAIM_BATCH 8
+#define FLUSH_BATCH_MAX 32U /* past this many pages one full flush beats invlpg each */
+
+static uint32_t kernel_pd_phys = 0;
 static uint32_t current_pd_phys = 0;
 static uint32_t *current_pd = 0;
+static uint32_t cow_faults = 0;
+static uint32_t physmap_offset = 0; /* 0 until paging is on: frames are then reached directly */
+static uint32_t physmap_end = 0;
+static uint32_t mmio_next = MMIO_VIRT;
+static int pse_enabled = 0;
+static int pge_supported = 0;
+static uint32_t kernel_small_end = 0; /* 4 MiB slots below this hold .text/.rodata: 4 KiB pages */
+
+/*
+ * Read faults on untouched user memory map this one zeroed frame read-only
+ * and copy-on-write; the first write swaps in a private zeroed frame. The
+ * frame is PG_RESERVED, so mapping and unmapping it never touches a count.
+ */
+static uint32_t zero_frame = 0;
+static uint32_t zero_page_hits = 0;
+static uint32_t zero_page_upgrades = 0;
+
+/*
+ * Pages whose translation changed during one range operation. Up to
+ * FLUSH_BATCH_MAX are invalidated one by one; beyond that the whole TLB is
+ * flushed once, global entries too if any kernel page was involved.
+ */
+typedef struct {
+    uint32_t count;
+    int global;
+    uint32_t addrs[FLUSH_BATCH_MAX];
+} flush_batch_t;
+
+static uint32_t tlb_pages_flushed = 0;
+static uint32_t tlb_full_flushes = 0;
 
 static inline uint32_t align_up(uint32_t value, uint32_t align)
 {
@@ -23,65 +85,332 @@ static inline void invlpg(uint32_t addr)
 
 static uint32_t *phys_to_ptr(uint32_t phys)
 {
-    return (uint32_t *)(phys);
+    return (uint32_t *)(phys + physmap_offset);
 }
 
-static uint32_t evict_pd_idx = 0;
-static uint32_t evict_pt_idx = 0;
+static void flush_batch_add(flush_batch_t *batch, uint32_t virt, uint32_t old_entry)
+{
+    if (old_entry & PAGE_GLOBAL) {
+        batch->global = 1;
+    }
+    if (batch->count < FLUSH_BATCH_MAX) {
+        batch->addrs[batch->count] = virt;
+    }
+    ++batch->count;
+}
 
-static uint32_t get_virt_from_indices(uint32_t pd_index, uint32_t pt_index) {
-    return (pd_index << 22) | (pt_index << 12);
+static void flush_batch_run(flush_batch_t *batch)
+{
+    if (batch->count > FLUSH_BATCH_MAX) {
+        if (batch->global) {
+            paging_flush_tlb_all();
+        } else {
+            __asm__ volatile ("mov %0, %%cr3" :: "r"(current_pd_phys) : "memory");
+        }
+        ++tlb_full_flushes;
+    } else {
+        for (uint32_t i = 0; i < batch->count; ++i) {
+            invlpg(batch->addrs[i]);
+        }
+        tlb_pages_flushed += batch->count;
+    }
+    batch->count = 0;
+    batch->global = 0;
 }
 
-static int paging_evict_page(void) {
-    int pages_checked = 0;
-    // We only scan user space (0 to 0xC0000000), which is PD entries 0 to 767.
-    // 768 entries * 1024 pages = 786432 pages max.
-    int max_checks = 768 * 1024 * 2; // 2 passes
-    
-    while (pages_checked < max_checks) {
-        // Advance indices
-        evict_pt_idx++;
-        if (evict_pt_idx >= 1024) {
-            evict_pt_idx = 0;
-            evict_pd_idx++;
-            if (evict_pd_idx >= 768) {
-                evict_pd_idx = 0;
-            }
+/*
+ * Reverse mappings. A private user frame on the LRU records the PTE that
+ * maps it in page->mapping as the page table's physical address with the
+ * entry index in the low bits; the page table's own descriptor records its
+ * directory and directory slot the same way. Together they give the entry,
+ * its virtual address and whether its directory is loaded, without walking
+ * any address space. Mappings can change behind an rmap (copy-on-write,
+ * unmapping without freeing), so rmap_pte() checks that the entry still maps
+ * the frame before reclaim trusts it.
+ */
+#define PAGE_ACCESSED 0x20U
+#define LRU_SCAN_PER_PAGE 32U /* inactive pages examined per page wanted */
+#define LRU_AGE_BATCH     32U /* active pages aged at a time */
+
+static uint32_t reclaim_scanned = 0;
+static uint32_t reclaim_activated = 0;
+static uint32_t reclaim_deactivated = 0;
+static uint32_t reclaim_freed = 0;
+static uint32_t stall_count = 0;       /* allocations that reclaimed directly */
+static uint32_t stall_kcycles = 0;     /* time they spent, in 1024-cycle units */
+static uint32_t stall_max_kcycles = 0;
+
+/*
+ * Victims gathered for one swap write. Each keeps the entry value it was
+ * chosen with: an entry that changed by the time the write completes
+ * (touched, dirtied, remapped) keeps its frame and the slot goes back.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t frames[SWAP_BATCH_MAX];
+    uint32_t *ptes[SWAP_BATCH_MAX];
+    uint32_t entries[SWAP_BATCH_MAX];
+    uint32_t virts[SWAP_BATCH_MAX];
+    uint8_t current[SWAP_BATCH_MAX];
+} writeback_t;
+
+static void *scratch_map(uint32_t slot, uint32_t phys);
+static void scratch_unmap(uint32_t slot);
+
+static void rmap_tag_table(uint32_t table_phys, uint32_t pd_phys, uint32_t pd_index)
+{
+    page_t *page = pmm_page(table_phys);
+    if (page && pd_index >= IDENTITY_PDES && pd_index < USER_PDES) {
+        page->flags |= PG_PGTABLE;
+        page->mapping = (void *)(pd_phys | pd_index);
+    }
+}
+
+/* Records that entry index of table_phys maps phys and puts phys on the LRU. */
+static void rmap_set(uint32_t phys, uint32_t table_phys, uint32_t index)
+{
+    page_t *page = pmm_page(phys);
+    if (!page || (page->flags & (PG_RESERVED | PG_SHARED | PG_LOCKED))) {
+        return;
+    }
+    page->mapping = (void *)(table_phys | (index << 2));
+    lru_add(page);
+}
+
+/* Same, for a user address in the current directory. */
+static void rmap_track(uint32_t virt, uint32_t phys)
+{
+    uint32_t pde = current_pd[virt >> 22];
+    if (virt < IDENTITY_PDES * LARGE_PAGE_SIZE || virt >= KERNEL_VIRT_BASE ||
+        !(pde & PAGE_PRESENT) || (pde & PAGE_PSE)) {
+        return;
+    }
+    rmap_set(phys, pde & ~0xFFFU, (virt >> 12) & 0x3FFU);
+}
+
+/* The entry mapping page, or NULL once the rmap no longer describes it. */
+static uint32_t *rmap_pte(page_t *page, uint32_t *virt, int *current)
+{
+    uint32_t ref = (uint32_t)page->mapping;
+    page_t *table = pmm_page(ref & ~0xFFFU);
+    if (!table || !(table->flags & PG_PGTABLE)) {
+        return NULL;
+    }
+    uint32_t index = (ref & 0xFFFU) >> 2;
+    uint32_t *pte = phys_to_ptr(ref & ~0xFFFU) + index;
+    if (!(*pte & PAGE_PRESENT) || (*pte & ~0xFFFU) != pmm_page_addr(page)) {
+        return NULL;
+    }
+    uint32_t slot = (uint32_t)table->mapping;
+    *virt = ((slot & 0x3FFU) << 22) | (index << 12);
+    *current = (slot & ~0xFFFU) == current_pd_phys;
+    return pte;
+}
+
+/*
+ * Clears the accessed bit of a page's entry and reports whether it was set.
+ * Entries of other directories need no invalidation: loading their CR3
+ * flushes every non-global translation anyway.
+ */
+static int test_and_clear_accessed(uint32_t *pte, uint32_t virt, int current, flush_batch_t *batch)
+{
+    if (!(*pte & PAGE_ACCESSED)) {
+        return 0;
+    }
+    *pte &= ~PAGE_ACCESSED;
+    if (current) {
+        flush_batch_add(batch, virt, *pte);
+    }
+    return 1;
+}
+
+/* Moves up to LRU_AGE_BATCH pages off the active tail; referenced ones stay. */
+static uint32_t age_active(flush_batch_t *batch)
+{
+    uint32_t aged = 0;
+    for (; aged < LRU_AGE_BATCH; ++aged) {
+        page_t *page = lru_tail(LRU_ACTIVE);
+        if (!page) {
+            break;
         }
-        
-        if (current_pd[evict_pd_idx] & PAGE_PRESENT) {
-            uint32_t *pt = phys_to_ptr(current_pd[evict_pd_idx] & ~0xFFF);
-            if (pt[evict_pt_idx] & PAGE_PRESENT) {
-                 // Check Accessed bit (Bit 5)
-                 if (pt[evict_pt_idx] & 0x20) {
-                     pt[evict_pt_idx] &= ~0x20; // Clear accessed bit
-                     invlpg(get_virt_from_indices(evict_pd_idx, evict_pt_idx));
-                 } else {
-                     // Found victim (Accessed bit is 0)
-                     uint32_t virt = get_virt_from_indices(evict_pd_idx, evict_pt_idx);
-                     // Try to swap out. If successful, we freed a frame.
-                     if (paging_swap_out(virt) == 0) {
-                         return 1;
-                     }
-                 }
-            }
+        uint32_t virt;
+        int current;
+        uint32_t *pte = rmap_pte(page, &virt, &current);
+        if (!pte) {
+            lru_del(page); // relinked by the next rmap_set
+        } else if (test_and_clear_accessed(pte, virt, current, batch)) {
+            lru_move(page, LRU_ACTIVE);
         } else {
-            // Optimization: If PD entry is empty, skip all its PT entries
-            evict_pt_idx = 1023; // Next loop iteration will roll over to next PD
+            lru_move(page, LRU_INACTIVE);
+            ++reclaim_deactivated;
         }
-        pages_checked++;
     }
-    return 0;
+    return aged;
+}
+
+static void writeback_add(writeback_t *wb, page_t *page, uint32_t *pte, uint32_t virt, int current)
+{
+    uint32_t i = wb->count++;
+    wb->frames[i] = pmm_page_addr(page);
+    wb->ptes[i] = pte;
+    wb->entries[i] = *pte;
+    wb->virts[i] = virt;
+    wb->current[i] = (uint8_t)current;
+    page->flags |= PG_WRITEBACK;
+    lru_move(page, LRU_INACTIVE); // out of the way of the scan until written
+}
+
+/*
+ * Writes the gathered pages to adjacent swap slots with as few commands as
+ * the free slots allow. Only once the data is on disk are the entries
+ * switched to their slots; the loaded directory's translations are dropped
+ * before any frame goes back to the PMM. Returns the pages freed.
+ */
+static uint32_t writeback_run(writeback_t *wb, flush_batch_t *batch)
+{
+    uint32_t slots[SWAP_BATCH_MAX];
+    uint32_t written = wb->count ? (uint32_t)swap_out_frames(wb->frames, wb->count, slots) : 0;
+    uint32_t freed = 0;
+    for (uint32_t i = 0; i < wb->count; ++i) {
+        pmm_page(wb->frames[i])->flags &= ~PG_WRITEBACK;
+        if (i >= written) {
+            wb->frames[i] = 0;
+            continue;
+        }
+        if (*wb->ptes[i] != wb->entries[i]) {
+            swap_free(slots[i]);
+            wb->frames[i] = 0;
+            continue;
+        }
+        *wb->ptes[i] = (slots[i] << 12) | PAGE_SWAPPED; // Present bit is 0
+        if (wb->current[i]) {
+            flush_batch_add(batch, wb->virts[i], wb->entries[i]);
+        }
+    }
+    flush_batch_run(batch);
+    for (uint32_t i = 0; i < wb->count; ++i) {
+        if (wb->frames[i]) {
+            pmm_free_frame(wb->frames[i]); // also takes it off the LRU
+            ++freed;
+        }
+    }
+    wb->count = 0;
+    return freed;
 }
 
-static uint32_t alloc_frame_zero(void)
+/*
+ * Swaps out up to nr cold pages whose frames can serve zone, from any
+ * address space. The inactive list is scanned from its tail: referenced
+ * pages are promoted, shared or wrong-zone ones rotated, and the rest
+ * gathered into batches of up to SWAP_BATCH_MAX for one swap write each.
+ * The active list is aged whenever it outgrows the inactive one. Work is
+ * bounded by LRU_SCAN_PER_PAGE per page wanted. Runs with interrupts off,
+ * so nothing touches the victims between choosing and writing them.
+ */
+static uint32_t shrink_lru(uint32_t zone, uint32_t nr)
 {
-    uint32_t phys = pmm_alloc_frame();
+    flush_batch_t batch = { 0, 0, { 0 } };
+    writeback_t wb;
+    wb.count = 0;
+    uint32_t budget = nr * LRU_SCAN_PER_PAGE;
+    uint32_t freed = 0;
+    uint32_t irq = cpu_save_irq();
+    while (freed + wb.count < nr && budget) {
+        if (lru_count(LRU_INACTIVE) < lru_count(LRU_ACTIVE)) {
+            uint32_t aged = age_active(&batch);
+            budget -= aged < budget ? aged : budget;
+        }
+        page_t *page = lru_tail(LRU_INACTIVE);
+        if (!page || !budget || (page->flags & PG_WRITEBACK)) {
+            break; // empty, or wrapped around to this batch's own victims
+        }
+        --budget;
+        ++reclaim_scanned;
+        uint32_t virt;
+        int current;
+        uint32_t *pte = rmap_pte(page, &virt, &current);
+        if (!pte) {
+            lru_del(page);
+            continue;
+        }
+        if (test_and_clear_accessed(pte, virt, current, &batch)) {
+            lru_move(page, LRU_ACTIVE);
+            ++reclaim_activated;
+            continue;
+        }
+        // Shared frames stay: other mappings would still point at them.
+        if (pmm_frame_zone(pmm_page_addr(page)) > zone || page->count != 1) {
+            lru_move(page, LRU_INACTIVE);
+            continue;
+        }
+        writeback_add(&wb, page, pte, virt, current);
+        if (wb.count == SWAP_BATCH_MAX) {
+            uint32_t got = writeback_run(&wb, &batch);
+            freed += got;
+            if (!got) {
+                break; // swap is full
+            }
+        }
+    }
+    freed += writeback_run(&wb, &batch);
+    cpu_restore_irq(irq);
+    reclaim_freed += freed;
+    return freed;
+}
+
+uint32_t paging_reclaim(uint32_t zone, uint32_t pages)
+{
+    return shrink_lru(zone, pages);
+}
+
+/*
+ * Reclaim done by the allocating task itself: the allocation stalls for
+ * the scan and the swap writes. Counted and timed, in units of 1024 cycles.
+ */
+static uint32_t direct_reclaim(uint32_t zone, uint32_t pages)
+{
+    uint64_t t0 = cpu_rdtsc();
+    uint32_t freed = swap_cache_shrink(); // unread read-ahead goes first
+    freed += shrink_lru(zone, pages);
+    uint32_t kcycles = (uint32_t)((cpu_rdtsc() - t0) >> 10);
+    ++stall_count;
+    stall_kcycles += kcycles;
+    if (kcycles > stall_max_kcycles) {
+        stall_max_kcycles = kcycles;
+    }
+    return freed;
+}
+
+/*
+ * Once the zones a request can use drop below their low watermark, trim the
+ * heap's mapped slack and wake kswapd to write out cold pages in the
+ * background. Only below the min watermark, where kswapd has fallen behind,
+ * does the allocation reclaim a batch itself.
+ */
+static void reclaim_for_zone(uint32_t zone)
+{
+    if (pmm_watermark_ok(zone, PMM_WMARK_LOW)) {
+        return;
+    }
+    // Idle heap slack is the cheapest memory to give back.
+    heap_release_slack();
+    if (!swap_available()) {
+        return;
+    }
+    kswapd_wake(zone);
+    if (!pmm_watermark_ok(zone, PMM_WMARK_MIN)) {
+        direct_reclaim(zone, RECLAIM_BATCH);
+    }
+}
+
+static uint32_t alloc_frame(uint32_t zone, int zeroed)
+{
+    reclaim_for_zone(zone);
+    uint32_t phys = zeroed ? pmm_alloc_zeroed_frame_zone(zone) : pmm_alloc_frame_zone(zone);
     if (phys == 0) {
-        // Try to evict a page to free up memory
-        if (paging_evict_page()) {
-            phys = pmm_alloc_frame();
+        // Last resort: direct eviction
+        if (direct_reclaim(zone, 1)) {
+            phys = zeroed ? pmm_alloc_zeroed_frame_zone(zone) : pmm_alloc_frame_zone(zone);
         }
         
         // Check again
@@ -92,20 +421,28 @@ static uint32_t alloc_frame_zero(void)
             }
         }
     }
-    memset(phys_to_ptr(phys), 0, PAGE_SIZE);
     return phys;
 }
 
+static uint32_t alloc_frame_zero(uint32_t zone)
+{
+    return alloc_frame(zone, 1);
+}
+
 static uint32_t *get_page_table(uint32_t virt, int create, uint32_t flags)
 {
     uint32_t pd_index = virt >> 22;
     uint32_t entry = current_pd[pd_index];
     
+    if (entry & PAGE_PSE) {
+        return NULL; // a 4 MiB page has no table
+    }
     if (!(entry & PAGE_PRESENT)) {
         if (!create) {
             return NULL;
         }
-        uint32_t table_phys = alloc_frame_zero();
+        uint32_t table_phys = alloc_frame_zero(TABLE_ZONE);
+        rmap_tag_table(table_phys, current_pd_phys, pd_index);
         uint32_t pd_flags = PAGE_PRESENT | PAGE_RW;
         if (flags & PAGE_USER) {
             pd_flags |= PAGE_USER;
@@ -126,9 +463,24 @@ static uint32_t *get_page_table(uint32_t virt, int create, uint32_t flags)
 void paging_map(uint32_t virt, uint32_t phys, uint32_t flags)
 {
     uint32_t *table = get_page_table(virt, 1, flags);
+    if (!table) {
+        uint32_t pde = current_pd[virt >> 22];
+        uint32_t want = flags & (PAGE_RW | PAGE_USER);
+        if ((pde & ~(LARGE_PAGE_SIZE - 1U)) + (virt & (LARGE_PAGE_SIZE - 1U)) == (phys & ~0xFFFU) &&
+            (pde & want) == want) {
+            return; // the large page already maps it with these rights
+        }
+        console_write("paging_map: address inside a large page: ");
+        console_write_hex(virt);
+        console_write("\n");
+        return;
+    }
     uint32_t pt_index = (virt >> 12) & 0x3FFU;
     table[pt_index] = (phys & ~0xFFFU) | PAGE_PRESENT | (flags & 0xFFFU);
     invlpg(virt);
+    if (flags & PAGE_USER) {
+        rmap_track(virt, phys & ~0xFFFU);
+    }
 }
 
 void paging_unmap(uint32_t virt)
@@ -144,6 +496,10 @@ void paging_unmap(uint32_t virt)
 
 uint32_t paging_virt_to_phys(uint32_t virt)
 {
+    uint32_t pde = current_pd[virt >> 22];
+    if ((pde & (PAGE_PRESENT | PAGE_PSE)) == (PAGE_PRESENT | PAGE_PSE)) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1U)) | (virt & (LARGE_PAGE_SIZE - 1U));
+    }
     uint32_t *table = get_page_table(virt, 0, 0);
     if (!table) {
         return 0;
@@ -156,6 +512,257 @@ uint32_t paging_virt_to_phys(uint32_t virt)
     return (entry & ~0xFFFU) | (virt & 0xFFFU);
 }
 
+/*
+ * Maps pages pages at virt, to frames[i] or, without a frame list, to the
+ * contiguous range starting at phys. Each page table is looked up once per
+ * 4 MiB slot; only entries that were already present need invalidating.
+ */
+static void map_range(uint32_t virt, uint32_t phys, const uint32_t *frames,
+                      uint32_t pages, uint32_t flags)
+{
+    flush_batch_t batch = { 0, 0, { 0 } };
+    for (uint32_t done = 0; done < pages; ) {
+        uint32_t v = virt + done * PAGE_SIZE;
+        uint32_t idx = (v >> 12) & 0x3FFU;
+        uint32_t n = PAGE_TABLE_ENTRIES - idx;
+        if (n > pages - done) {
+            n = pages - done;
+        }
+        uint32_t *table = get_page_table(v, 1, flags);
+        for (uint32_t k = 0; k < n; ++k) {
+            uint32_t frame = frames ? frames[done + k] : phys + (done + k) * PAGE_SIZE;
+            if (!table) {
+                paging_map(v + k * PAGE_SIZE, frame, flags); // inside a large page
+                continue;
+            }
+            uint32_t old = table[idx + k];
+            table[idx + k] = (frame & ~0xFFFU) | PAGE_PRESENT | (flags & 0xFFFU);
+            if (old & PAGE_PRESENT) {
+                flush_batch_add(&batch, v + k * PAGE_SIZE, old);
+            }
+            if (flags & PAGE_USER) {
+                rmap_track(v + k * PAGE_SIZE, frame & ~0xFFFU);
+            }
+        }
+        done += n;
+    }
+    flush_batch_run(&batch);
+}
+
+void paging_map_range(uint32_t virt, uint32_t phys, uint32_t pages, uint32_t flags)
+{
+    map_range(virt, phys & ~0xFFFU, NULL, pages, flags);
+}
+
+void paging_map_frames(uint32_t virt, const uint32_t *frames, uint32_t pages, uint32_t flags)
+{
+    map_range(virt, 0, frames, pages, flags);
+}
+
+uint32_t paging_unmap_range(uint32_t virt, uint32_t pages, int free_frames)
+{
+    flush_batch_t batch = { 0, 0, { 0 } };
+    uint32_t unmapped = 0;
+    for (uint32_t done = 0; done < pages; ) {
+        uint32_t v = virt + done * PAGE_SIZE;
+        uint32_t idx = (v >> 12) & 0x3FFU;
+        uint32_t n = PAGE_TABLE_ENTRIES - idx;
+        if (n > pages - done) {
+            n = pages - done;
+        }
+        uint32_t *table = get_page_table(v, 0, 0);
+        for (uint32_t k = 0; table && k < n; ++k) {
+            uint32_t old = table[idx + k];
+            if (old & PAGE_PRESENT) {
+                table[idx + k] = 0;
+                flush_batch_add(&batch, v + k * PAGE_SIZE, old);
+                if (free_frames) {
+                    pmm_free_frame(old & ~0xFFFU);
+                }
+                ++unmapped;
+            } else if (old & PAGE_SWAPPED) {
+                table[idx + k] = 0;
+                if (free_frames) {
+                    swap_free(old >> 12);
+                }
+            }
+        }
+        done += n;
+    }
+    flush_batch_run(&batch);
+    return unmapped;
+}
+
+void paging_protect_range(uint32_t virt, uint32_t pages, uint32_t flags)
+{
+    flush_batch_t batch = { 0, 0, { 0 } };
+    for (uint32_t done = 0; done < pages; ) {
+        uint32_t v = virt + done * PAGE_SIZE;
+        uint32_t idx = (v >> 12) & 0x3FFU;
+        uint32_t n = PAGE_TABLE_ENTRIES - idx;
+        if (n > pages - done) {
+            n = pages - done;
+        }
+        uint32_t *table = get_page_table(v, 0, flags);
+        for (uint32_t k = 0; table && k < n; ++k) {
+            uint32_t old = table[idx + k];
+            if (!(old & PAGE_PRESENT)) {
+                continue;
+            }
+            uint32_t entry = (old & ~(PAGE_RW | PAGE_USER)) | (flags & (PAGE_RW | PAGE_USER));
+            page_t *page = pmm_page(old & ~0xFFFU);
+            if ((entry & PAGE_RW) && page && !(page->flags & (PG_SHARED | PG_RESERVED)) &&
+                page->count > 1) {
+                entry |= PAGE_COW; // a private frame another directory still maps (fork)
+            }
+            if (entry & PAGE_COW) {
+                entry &= ~PAGE_RW; // stays read-only until the copy
+            }
+            if (entry != old) {
+                table[idx + k] = entry;
+                flush_batch_add(&batch, v + k * PAGE_SIZE, old);
+            }
+        }
+        done += n;
+    }
+    flush_batch_run(&batch);
+}
+
+void paging_tlb_stats(uint32_t *pages_flushed, uint32_t *full_flushes)
+{
+    if (pages_flushed) {
+        *pages_flushed = tlb_pages_flushed;
+    }
+    if (full_flushes) {
+        *full_flushes = tlb_full_flushes;
+    }
+}
+
+/*
+ * Directories copy the kernel half when they are created, so a kernel page
+ * table added later would only appear in the directory that was current.
+ * Kernel windows that grow at runtime create their tables up front instead.
+ */
+void paging_reserve_kernel_tables(uint32_t virt, uint32_t size)
+{
+    uint32_t first = virt & ~0x3FFFFFU;
+    uint32_t span = size + (virt - first);
+    for (uint32_t offset = 0; offset < span; offset += 0x400000U) {
+        get_page_table(first + offset, 1, 0);
+    }
+}
+
+/* Maps phys into scratch slot 0 or 1; physmap frames need no mapping. */
+static void *scratch_map(uint32_t slot, uint32_t phys)
+{
+    if (!physmap_offset || phys + PAGE_SIZE <= physmap_end) {
+        return phys_to_ptr(phys);
+    }
+    uint32_t virt = SCRATCH_VIRT + slot * PAGE_SIZE;
+    uint32_t *table = get_page_table(virt, 0, 0);
+    table[(virt >> 12) & 0x3FFU] = (phys & ~0xFFFU) | PAGE_PRESENT | PAGE_RW;
+    invlpg(virt);
+    return (void *)virt;
+}
+
+static void scratch_unmap(uint32_t slot)
+{
+    uint32_t virt = SCRATCH_VIRT + slot * PAGE_SIZE;
+    uint32_t *table = get_page_table(virt, 0, 0);
+    if (table && table[(virt >> 12) & 0x3FFU]) {
+        table[(virt >> 12) & 0x3FFU] = 0;
+        invlpg(virt);
+    }
+}
+
+/* Reads a swap slot straight into a frame through the physmap (or scratch). */
+static int swap_in_frame(uint32_t swap_slot, uint32_t phys)
+{
+    uint32_t irq = cpu_save_irq();
+    int rc = swap_in(swap_slot, scratch_map(0, phys));
+    scratch_unmap(0);
+    cpu_restore_irq(irq);
+    return rc;
+}
+
+/* A neighbour worth reading ahead: swapped to the slot want, not cached yet. */
+static int readahead_candidate(uint32_t entry, uint32_t want)
+{
+    return !(entry & PAGE_PRESENT) && (entry & PAGE_SWAPPED) && (entry >> 12) == want &&
+           !swap_cache_lookup(want);
+}
+
+/*
+ * Reads the slot behind table[idx] into phys, together with the slots of
+ * neighbouring entries that were swapped out next to it (consecutive slots
+ * for consecutive pages, as a batched swap-out leaves them), in one
+ * command. The window is SWAP_RA_MAX entries, aligned. The neighbours'
+ * copies go to the swap cache, so their faults need no I/O. Frames for
+ * them never trigger reclaim or dip below the low watermark; the window
+ * ends at the first one that cannot be had.
+ */
+static int swap_readahead(uint32_t *table, uint32_t idx, uint32_t phys)
+{
+    uint32_t slot = table[idx] >> 12;
+    uint32_t base = idx & ~(SWAP_RA_MAX - 1U);
+    uint32_t frames[SWAP_RA_MAX];
+    uint32_t lo = idx;
+    uint32_t hi = idx + 1U;
+    frames[idx - base] = phys;
+    while (lo > base && readahead_candidate(table[lo - 1U], slot - (idx - lo + 1U))) {
+        uint32_t extra = pmm_try_alloc_frame_zone(PAGE_ZONE);
+        if (!extra) {
+            break;
+        }
+        frames[--lo - base] = extra;
+    }
+    while (hi < base + SWAP_RA_MAX && readahead_candidate(table[hi], slot + (hi - idx))) {
+        uint32_t extra = pmm_try_alloc_frame_zone(PAGE_ZONE);
+        if (!extra) {
+            break;
+        }
+        frames[hi++ - base] = extra;
+    }
+
+    int rc = swap_in_frames(slot - (idx - lo), &frames[lo - base], hi - lo);
+    for (uint32_t j = lo; j < hi; ++j) {
+        if (j == idx) {
+            continue;
+        }
+        if (rc == 0) {
+            swap_cache_add(slot + j - idx, frames[j - base]);
+        } else {
+            pmm_free_frame(frames[j - base]);
+        }
+    }
+    return rc;
+}
+
+/*
+ * Physmap frames are zeroed with interrupts left alone; only frames that
+ * need the shared scratch slot hold interrupts off for the memset.
+ */
+void paging_zero_frame(uint32_t phys)
+{
+    if (physmap_offset && phys + PAGE_SIZE <= physmap_end) {
+        memset(phys_to_ptr(phys), 0, PAGE_SIZE);
+        return;
+    }
+    uint32_t irq = cpu_save_irq();
+    memset(scratch_map(0, phys), 0, PAGE_SIZE);
+    scratch_unmap(0);
+    cpu_restore_irq(irq);
+}
+
+void paging_copy_frame(uint32_t dst_phys, uint32_t src_phys)
+{
+    uint32_t irq = cpu_save_irq();
+    memcpy(scratch_map(0, dst_phys), scratch_map(1, src_phys), PAGE_SIZE);
+    scratch_unmap(0);
+    scratch_unmap(1);
+    cpu_restore_irq(irq);
+}
+
 static void load_page_directory(uint32_t phys)
 {
     __asm__ volatile ("mov %0, %%cr3" :: "r"(phys));
@@ -167,12 +774,19 @@ static void load_page_directory(uint32_t phys)
 
 static void map_identity_region(uint32_t length)
 {
+    if (pse_enabled) {
+        // Map as User-accessible for demo purposes, see below
+        for (uint32_t phys = 0; phys < length; phys += LARGE_PAGE_SIZE) {
+            current_pd[phys >> 22] = phys | PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_PSE | PAGE_GLOBAL;
+        }
+        return;
+    }
     uint32_t pages = align_up(length, PAGE_SIZE) / PAGE_SIZE;
     for (uint32_t i = 0; i < pages; ++i) {
         uint32_t phys = i * PAGE_SIZE;
         // Map as User-accessible for demo purposes (allows Ring 3 to execute kernel code)
         // In a real OS, this would be a security issue
-        paging_map(phys, phys, PAGE_RW | PAGE_USER);
+        paging_map(phys, phys, PAGE_RW | PAGE_USER | PAGE_GLOBAL);
     }
 }
 
@@ -191,22 +805,29 @@ static void map_kernel_higher_half(void)
     uint32_t data_start = (uint32_t)&_data_start;
     uint32_t kernel_end = align_up((uint32_t)&end, PAGE_SIZE);
 
+    // Only the 4 MiB slots holding read-only sections need 4 KiB pages; the
+    // physmap covers the rest of .data/.bss with large pages.
+    kernel_small_end = pse_enabled ? align_up(rodata_end, LARGE_PAGE_SIZE) : kernel_end;
+    if (kernel_end > kernel_small_end) {
+        kernel_end = kernel_small_end;
+    }
+
     // Map .text as Read-Only (Supervisor)
     for (uint32_t phys = text_start; phys < text_end; phys += PAGE_SIZE) {
         uint32_t virt = KERNEL_VIRT_BASE + phys;
-        paging_map(virt, phys, 0); // 0 = Present, Supervisor, Read-Only (if WP=1)
+        paging_map(virt, phys, PAGE_GLOBAL); // Present, Supervisor, Read-Only (if WP=1)
     }
 
     // Map .rodata as Read-Only (Supervisor)
     for (uint32_t phys = rodata_start; phys < rodata_end; phys += PAGE_SIZE) {
         uint32_t virt = KERNEL_VIRT_BASE + phys;
-        paging_map(virt, phys, 0); // 0 = Present, Supervisor, Read-Only
+        paging_map(virt, phys, PAGE_GLOBAL); // Present, Supervisor, Read-Only
     }
 
     // Map .data and .bss as Read-Write (Supervisor)
     for (uint32_t phys = data_start; phys < kernel_end; phys += PAGE_SIZE) {
         uint32_t virt = KERNEL_VIRT_BASE + phys;
-        paging_map(virt, phys, PAGE_RW); // Present, Supervisor, Read-Write
+        paging_map(virt, phys, PAGE_RW | PAGE_GLOBAL); // Present, Supervisor, Read-Write
     }
     
     // Map any gaps (e.g. multiboot header before text) as Read-Only
@@ -216,14 +837,159 @@ static void map_kernel_higher_half(void)
     if (text_start > kernel_base) {
         for (uint32_t phys = kernel_base; phys < text_start; phys += PAGE_SIZE) {
              uint32_t virt = KERNEL_VIRT_BASE + phys;
-             paging_map(virt, phys, 0);
+             paging_map(virt, phys, PAGE_GLOBAL);
+        }
+    }
+}
+
+/*
+ * Resolves a write to a PAGE_COW page: the last sharer takes the frame back
+ * writable, anyone else gets a private copy and drops its reference.
+ */
+static int cow_fault(uint32_t virt)
+{
+    uint32_t *table = get_page_table(virt, 0, 0);
+    if (!table) {
+        return 0;
+    }
+    uint32_t pt_index = (virt >> 12) & 0x3FFU;
+    uint32_t entry = table[pt_index];
+    if (!(entry & PAGE_PRESENT) || !(entry & PAGE_COW)) {
+        return 0;
+    }
+    uint32_t phys = entry & ~0xFFFU;
+    uint32_t flags = (entry & 0xFFFU & ~PAGE_COW) | PAGE_RW;
+    if (phys == zero_frame) {
+        phys = alloc_frame_zero(PAGE_ZONE);
+        ++zero_page_upgrades;
+    } else if (pmm_page_count(phys) > 1) {
+        uint32_t copy = alloc_frame(PAGE_ZONE, 0);
+        paging_copy_frame(copy, phys);
+        pmm_free_frame(phys);
+        phys = copy;
+    }
+    table[pt_index] = phys | flags;
+    invlpg(virt);
+    rmap_track(virt, phys); // the copy, or the frame its last sharer now owns
+    ++cow_faults;
+    return 1;
+}
+
+/*
+ * Linear map of low memory at KERNEL_VIRT_BASE. The 4 MiB slots holding
+ * .text/.rodata keep 4 KiB tables so those stay read-only; the rest of low
+ * memory uses 4 MiB pages when the CPU has PSE.
+ */
+static void map_physmap(void)
+{
+    uint64_t ram_end = memblock_end_of_ram();
+    physmap_end = ram_end < PMM_LOWMEM_LIMIT ? align_up((uint32_t)ram_end, LARGE_PAGE_SIZE)
+                                             : PMM_LOWMEM_LIMIT;
+
+    for (uint32_t phys = 0; phys < physmap_end; phys += PAGE_SIZE) {
+        uint32_t virt = KERNEL_VIRT_BASE + phys;
+        if (pse_enabled && phys >= kernel_small_end) {
+            current_pd[virt >> 22] = phys | PAGE_PRESENT | PAGE_RW | PAGE_PSE | PAGE_GLOBAL;
+            phys += LARGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+        uint32_t *table = get_page_table(virt, 1, 0);
+        uint32_t pt_index = (virt >> 12) & 0x3FFU;
+        if (!(table[pt_index] & PAGE_PRESENT)) {
+            table[pt_index] = phys | PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL;
+        }
+    }
+}
+
+/*
+ * Hands out MMIO window space. Ranges of 4 MiB or more are placed at the same
+ * offset within a 4 MiB slot as their physical address, so every whole slot
+ * they cover becomes one large PDE.
+ */
+static void *map_mmio_range(uint32_t phys, uint32_t size, uint32_t cache)
+{
+    uint32_t offset = phys & 0xFFFU;
+    uint32_t base = phys & ~0xFFFU;
+    uint32_t span = align_up(size + offset, PAGE_SIZE);
+    uint32_t virt = mmio_next;
+    if (pse_enabled && span >= LARGE_PAGE_SIZE) {
+        virt = align_up(mmio_next, LARGE_PAGE_SIZE) + (base & (LARGE_PAGE_SIZE - 1U));
+    }
+    if (virt >= SCRATCH_VIRT || span > SCRATCH_VIRT - virt) {
+        return NULL;
+    }
+    mmio_next = virt + span;
+
+    for (uint32_t done = 0; done < span; ) {
+        uint32_t v = virt + done;
+        uint32_t p = base + done;
+        if (pse_enabled && !(v & (LARGE_PAGE_SIZE - 1U)) && span - done >= LARGE_PAGE_SIZE &&
+            !(current_pd[v >> 22] & PAGE_PRESENT)) {
+            current_pd[v >> 22] = p | PAGE_PRESENT | PAGE_RW | PAGE_PSE | PAGE_GLOBAL | cache;
+            invlpg(v);
+            done += LARGE_PAGE_SIZE;
+            continue;
         }
+        paging_map(v, p, PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL | cache);
+        done += PAGE_SIZE;
     }
+    return (void *)(virt + offset);
 }
 
-#include <mem/swap.h>
+void *paging_map_mmio(uint32_t phys, uint32_t size)
+{
+    return map_mmio_range(phys, size, PAGE_PCD | PAGE_PWT);
+}
+
+void *paging_map_mmio_cached(uint32_t phys, uint32_t size)
+{
+    return map_mmio_range(phys, size, 0);
+}
 
-// ...
+/*
+ * Populates the untouched neighbours of a demand fault the same way the
+ * fault itself was served: the shared zero page after a read, zeroed frames
+ * after a write. Present and swapped-out entries are left alone. The window
+ * is aligned to its size, so it stays inside the faulting page's table, and
+ * the entries it fills were not present, so nothing needs invalidating.
+ */
+static void fault_around(vm_space_t *space, const vma_t *vma, uint32_t virt, int write)
+{
+    uint32_t start;
+    uint32_t pages;
+    vma_fault_window(space, vma, virt, &start, &pages);
+    uint32_t *table = get_page_table(virt, 0, 0);
+    if (pages <= 1 || !table) {
+        return;
+    }
+    uint32_t flags = write ? vma_page_flags(vma->prot) : (PAGE_PRESENT | PAGE_USER | PAGE_COW);
+    uint32_t mapped = 0;
+    for (uint32_t i = 0; i < pages; ++i) {
+        uint32_t page = start + i * PAGE_SIZE;
+        uint32_t pt_index = (page >> 12) & 0x3FFU;
+        if (page == virt || table[pt_index]) {
+            continue;
+        }
+        uint32_t phys = zero_frame;
+        if (write) {
+            // Speculative: never evict for them or dip below the low mark
+            phys = pmm_try_alloc_zeroed_frame_zone(PAGE_ZONE);
+            if (!phys) {
+                break;
+            }
+        }
+        table[pt_index] = phys | flags;
+        rmap_track(page, phys);
+        ++mapped;
+    }
+    if (!write) {
+        zero_page_hits += mapped;
+    }
+    if (mapped) {
+        space->stats.prefaulted += mapped;
+        ++space->stats.windows;
+    }
+}
 
 void page_fault_handler(interrupt_frame_t *frame)
 {
@@ -237,6 +1003,32 @@ void page_fault_handler(interrupt_frame_t *frame)
 
     uint32_t page_aligned_virt = faulting_address & ~0xFFF;
 
+    // In a task with an address space, user addresses must fall inside an
+    // area that allows the access; anything else kills the task
+    vm_space_t *space = vma_current_space();
+    const vma_t *vma = NULL;
+    if (space && faulting_address < KERNEL_VIRT_BASE) {
+        vma = vma_find(space, faulting_address);
+        uint32_t need = rw ? VMA_WRITE : (VMA_READ | VMA_WRITE | VMA_EXEC);
+        if (!vma || !(vma->prot & need)) {
+            console_write("Segmentation fault: pid ");
+            console_write_dec(sched_get_current_pid());
+            console_write(" at ");
+            console_write_hex(faulting_address);
+            console_write("\n");
+            if (sched_exit_current(frame) == 0) {
+                return;
+            }
+            for (;;) {
+                __asm__ volatile("cli; hlt");
+            }
+        }
+    }
+    uint32_t user_flags = vma ? vma_page_flags(vma->prot) : (PAGE_PRESENT | PAGE_RW | PAGE_USER);
+    if (vma) {
+        ++space->stats.faults;
+    }
+
     // Check if page is swapped out
     uint32_t *table = get_page_table(page_aligned_virt, 0, 0);
     if (table) {
@@ -247,21 +1039,23 @@ void page_fault_handler(interrupt_frame_t *frame)
         if (!(entry & PAGE_PRESENT) && (entry & PAGE_SWAPPED)) {
             uint32_t swap_slot = entry >> 12;
             
-            console_write("Swap: Page fault on swapped page. Slot: ");
-            console_write_dec(swap_slot);
-            console_write("\n");
-            
-            // Allocate new frame
-            uint32_t phys = alloc_frame_zero();
-            
-            // Map it first so we can write to it
-            paging_map(page_aligned_virt, phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
-            
-            // Read from swap
-            if (swap_in(swap_slot, (void*)page_aligned_virt) != 0) {
-                console_write("Swap: Failed to read from swap!\n");
-                // Handle error...
+            // A neighbour's fault may already have read it ahead. Otherwise
+            // allocate a frame (the read overwrites all of it) and fill it,
+            // and its swapped neighbours, before it becomes visible
+            uint32_t irq = cpu_save_irq();
+            uint32_t phys = swap_cache_take(swap_slot);
+            cpu_restore_irq(irq);
+            if (!phys) {
+                phys = alloc_frame(PAGE_ZONE, 0);
+                irq = cpu_save_irq();
+                int rc = swap_readahead(table, pt_index, phys);
+                cpu_restore_irq(irq);
+                if (rc != 0) {
+                    console_write("Swap: Failed to read from swap!\n");
+                    // Handle error...
+                }
             }
+            paging_map(page_aligned_virt, phys, user_flags);
             
             // Free swap slot
             swap_free(swap_slot);
@@ -269,10 +1063,28 @@ void page_fault_handler(interrupt_frame_t *frame)
         }
     }
 
-    // Demand paging: if page is not present and it's a user access, allocate it
-    if (!present && user) {
-        uint32_t phys = alloc_frame_zero();
-        paging_map(page_aligned_virt, phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+    // Write to a copy-on-write page (from user mode, or the kernel writing a user buffer)
+    if (present && rw && faulting_address < KERNEL_VIRT_BASE && cow_fault(page_aligned_virt)) {
+        return;
+    }
+
+    // Demand paging: a user read of untouched memory sees the shared zero page;
+    // a write (or a read once it is gone) allocates a private zeroed frame
+    // (kernel accesses count too when they land in an area)
+    if (!present && (user || vma) && !rw && zero_frame) {
+        paging_map(page_aligned_virt, zero_frame, PAGE_PRESENT | PAGE_USER | PAGE_COW);
+        ++zero_page_hits;
+        if (vma) {
+            fault_around(space, vma, page_aligned_virt, 0);
+        }
+        return;
+    }
+    if (!present && (user || vma)) {
+        uint32_t phys = alloc_frame_zero(PAGE_ZONE);
+        paging_map(page_aligned_virt, phys, user_flags);
+        if (vma) {
+            fault_around(space, vma, page_aligned_virt, 1);
+        }
         return;
     }
 
@@ -290,52 +1102,123 @@ void page_fault_handler(interrupt_frame_t *frame)
     }
 }
 
+int paging_large_pages(void)
+{
+    return pse_enabled;
+}
+
+int paging_global_pages(void)
+{
+    if (!pge_supported) {
+        return -1;
+    }
+    return (cpu_read_cr4() & CR4_PGE) != 0;
+}
+
+int paging_set_global_pages(int enable)
+{
+    if (!pge_supported) {
+        return -1;
+    }
+    uint32_t cr4 = cpu_read_cr4();
+    cpu_write_cr4(enable ? (cr4 | CR4_PGE) : (cr4 & ~CR4_PGE));
+    return 0;
+}
+
+void paging_flush_tlb_all(void)
+{
+    uint32_t cr4 = cpu_read_cr4();
+    if (cr4 & CR4_PGE) {
+        // Clearing PGE invalidates global entries as well
+        cpu_write_cr4(cr4 & ~CR4_PGE);
+        cpu_write_cr4(cr4);
+        return;
+    }
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(current_pd_phys) : "memory");
+}
+
+uint32_t paging_cow_fault_count(void)
+{
+    return cow_faults;
+}
+
+void paging_zero_page_stats(uint32_t *hits, uint32_t *upgrades)
+{
+    *hits = zero_page_hits;
+    *upgrades = zero_page_upgrades;
+}
+
+void paging_stall_stats(uint32_t *stalls, uint32_t *total_kcycles, uint32_t *max_kcycles)
+{
+    *stalls = stall_count;
+    *total_kcycles = stall_kcycles;
+    *max_kcycles = stall_max_kcycles;
+}
+
+void paging_reclaim_stats(uint32_t *scanned, uint32_t *activated,
+                          uint32_t *deactivated, uint32_t *reclaimed)
+{
+    *scanned = reclaim_scanned;
+    *activated = reclaim_activated;
+    *deactivated = reclaim_deactivated;
+    *reclaimed = reclaim_freed;
+}
+
 int paging_swap_out(uint32_t virt) {
     uint32_t page_aligned_virt = virt & ~0xFFF;
     uint32_t *table = get_page_table(page_aligned_virt, 0, 0);
     if (!table) return -1;
     
     uint32_t pt_index = (page_aligned_virt >> 12) & 0x3FFU;
-    uint32_t entry = table[pt_index];
-    
-    if (!(entry & PAGE_PRESENT)) return -1; // Not present
+    if (!(table[pt_index] & PAGE_PRESENT)) return -1; // Not present
+    page_t *page = pmm_page(table[pt_index] & ~0xFFFU);
+    if (!page || (page->flags & PG_RESERVED)) return -1;
     
-    uint32_t phys = entry & ~0xFFF;
-    uint32_t swap_slot;
-    
-    // Write to swap
-    if (swap_out((void*)page_aligned_virt, &swap_slot) != 0) {
-        return -1;
-    }
-    
-    // Update PTE: Not Present, store swap slot in bits 12-31, set PAGE_SWAPPED
-    table[pt_index] = (swap_slot << 12) | PAGE_SWAPPED; // Present bit is 0
-    invlpg(page_aligned_virt);
-    
-    // Free physical frame
-    pmm_free_frame(phys);
-    
-    console_write("Swap: Swapped out page ");
-    console_write_hex(page_aligned_virt);
-    console_write(" to slot ");
-    console_write_dec(swap_slot);
-    console_write("\n");
-    
-    return 0;
+    flush_batch_t batch = { 0, 0, { 0 } };
+    writeback_t wb;
+    wb.count = 0;
+    uint32_t irq = cpu_save_irq();
+    writeback_add(&wb, page, &table[pt_index], page_aligned_virt, 1);
+    uint32_t freed = writeback_run(&wb, &batch);
+    cpu_restore_irq(irq);
+    return freed ? 0 : -1;
 }
 
 void paging_init(void)
 {
-    current_pd_phys = alloc_frame_zero();
+    current_pd_phys = alloc_frame_zero(TABLE_ZONE);
     current_pd = phys_to_ptr(current_pd_phys);
+    kernel_pd_phys = current_pd_phys;
 
     /* Recursive mapping for easy PD/PT access later */
     current_pd[1023] = current_pd_phys | PAGE_PRESENT | PAGE_RW;
 
-    map_identity_region(16 * 1024 * 1024); /* identity-map first 16 MiB */
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    pse_enabled = (edx & CPUID_EDX_PSE) != 0;
+    pge_supported = (edx & CPUID_EDX_PGE) != 0;
+
+    map_identity_region(IDENTITY_LIMIT); /* identity-map first 16 MiB */
     map_kernel_higher_half();
+    map_physmap();
+    get_page_table(SCRATCH_VIRT, 1, 0); /* shared by every directory cloned from here */
 
+    // Kernel mappings carry PAGE_GLOBAL (ignored without CR4.PGE), so the
+    // CR3 reload on every task switch only drops user translations.
+    uint32_t cr4 = cpu_read_cr4();
+    if (pse_enabled) {
+        cr4 |= CR4_PSE;
+    }
+    if (pge_supported) {
+        cr4 |= CR4_PGE;
+    }
+    cpu_write_cr4(cr4);
     load_page_directory(current_pd_phys);
+
+    // From here on, tables and frames are reached through the physmap
+    physmap_offset = KERNEL_VIRT_BASE;
+    current_pd = phys_to_ptr(current_pd_phys);
+    framebuffer_remap(); // before the next console write can reach it
     
     // Enable Write Protect (WP) bit in CR0 to enforce Read-Only protection for Ring 0
     uint32_t cr0;
@@ -344,11 +1227,23 @@ void paging_init(void)
     __asm__ volatile ("mov %0, %%cr0" :: "r"(cr0));
     
     register_interrupt_handler(14, page_fault_handler);
+
+    // Zeroing a frame outside the identity map needs paging up
+    zero_frame = alloc_frame_zero(PAGE_ZONE);
+    pmm_page(zero_frame)->flags |= PG_RESERVED;
     console_write("Paging enabled. Kernel mapped at higher half. WP enabled.\n");
+    console_write("Physmap: ");
+    console_write_dec(physmap_end / (1024 * 1024));
+    console_write(pse_enabled ? " MiB at 0xC0000000 (4 MiB pages)\n" : " MiB at 0xC0000000 (4 KiB pages)\n");
 }
 
 // Get kernel page directory physical address
 uint32_t paging_get_kernel_directory(void)
+{
+    return kernel_pd_phys;
+}
+
+uint32_t paging_get_current_directory(void)
 {
     return current_pd_phys;
 }
@@ -357,13 +1252,18 @@ uint32_t paging_get_kernel_directory(void)
 uint32_t paging_create_directory(void)
 {
     // Allocate new page directory
-    uint32_t new_pd_phys = alloc_frame_zero();
+    uint32_t new_pd_phys = alloc_frame_zero(TABLE_ZONE);
     uint32_t *new_pd = phys_to_ptr(new_pd_phys);
     
-    // Copy kernel mappings (upper half: 0xC0000000+)
-    // Kernel occupies page directory entries 768-1023 (0xC0000000 - 0xFFFFFFFF)
-    for (uint32_t i = 768; i < 1024; i++) {
-        new_pd[i] = current_pd[i];
+    // Copy kernel mappings: the identity map the kernel runs from (entries
+    // 0-3) and the upper half (entries 768-1023, 0xC0000000 - 0xFFFFFFFF).
+    // The page tables behind them are shared, never copied or freed.
+    uint32_t *kernel_pd = phys_to_ptr(kernel_pd_phys);
+    for (uint32_t i = 0; i < IDENTITY_PDES; i++) {
+        new_pd[i] = kernel_pd[i];
+    }
+    for (uint32_t i = USER_PDES; i < 1024; i++) {
+        new_pd[i] = kernel_pd[i];
     }
     
     // Set up recursive mapping for new directory
@@ -372,52 +1272,99 @@ uint32_t paging_create_directory(void)
     return new_pd_phys;
 }
 
-// Clone a page directory (for fork)
-uint32_t paging_clone_directory(uint32_t src_pd_phys)
+/*
+ * Private copy of a swapped-out page for a clone: the swap slot belongs to
+ * the source directory, so read it back into a fresh frame.
+ */
+static uint32_t clone_swapped_page(uint32_t swap_slot)
+{
+    uint32_t phys = alloc_frame(PAGE_ZONE, 0);
+    if (swap_in_frame(swap_slot, phys) != 0) {
+        pmm_free_frame(phys);
+        return 0;
+    }
+    return phys;
+}
+
+// Clone a page directory (for fork). User pages are shared copy-on-write:
+// writable entries lose PAGE_RW and gain PAGE_COW in both directories, and
+// each shared frame takes a reference. cow_fault() copies on the first write.
+uint32_t paging_clone_directory(uint32_t src_pd_phys, vm_space_t *space)
 {
     uint32_t *src_pd = phys_to_ptr(src_pd_phys);
-    uint32_t new_pd_phys = alloc_frame_zero();
+    uint32_t new_pd_phys = alloc_frame_zero(TABLE_ZONE);
     uint32_t *new_pd = phys_to_ptr(new_pd_phys);
+    int flush = 0;
+    int failed = 0;
     
-    // Copy all entries
-    for (uint32_t i = 0; i < 1024; i++) {
-        if (i >= 768) {
-            // Kernel space: share page tables
-            new_pd[i] = src_pd[i];
-        } else {
-            // User space: clone page tables
-            if (src_pd[i] & PAGE_PRESENT) {
-                uint32_t src_pt_phys = src_pd[i] & ~0xFFF;
-                uint32_t *src_pt = phys_to_ptr(src_pt_phys);
-                
-                // Allocate new page table
-                uint32_t new_pt_phys = alloc_frame_zero();
-                uint32_t *new_pt = phys_to_ptr(new_pt_phys);
-                
-                // Copy page table entries
-                for (uint32_t j = 0; j < 1024; j++) {
-                    if (src_pt[j] & PAGE_PRESENT) {
-                        // Allocate new physical page
-                        uint32_t new_page_phys = alloc_frame_zero();
-                        
-                        // Copy page content
-                        uint32_t src_page_phys = src_pt[j] & ~0xFFF;
-                        memcpy(phys_to_ptr(new_page_phys), phys_to_ptr(src_page_phys), PAGE_SIZE);
-                        
-                        // Set up new page table entry with same flags
-                        new_pt[j] = new_page_phys | (src_pt[j] & 0xFFF);
+    // Kernel space and the identity map: share page tables
+    for (uint32_t i = 0; i < IDENTITY_PDES; i++) {
+        new_pd[i] = src_pd[i];
+    }
+    for (uint32_t i = USER_PDES; i < 1024; i++) {
+        new_pd[i] = src_pd[i];
+    }
+
+    // User space: new page tables pointing at the same frames
+    for (uint32_t i = IDENTITY_PDES; i < USER_PDES && !failed; i++) {
+        if (!(src_pd[i] & PAGE_PRESENT)) {
+            continue;
+        }
+        uint32_t *src_pt = phys_to_ptr(src_pd[i] & ~0xFFFU);
+        uint32_t new_pt_phys = alloc_frame_zero(TABLE_ZONE);
+        uint32_t *new_pt = phys_to_ptr(new_pt_phys);
+        rmap_tag_table(new_pt_phys, new_pd_phys, i);
+
+        for (uint32_t j = 0; j < 1024 && !failed; j++) {
+            uint32_t entry = src_pt[j];
+            if (!(entry & PAGE_PRESENT)) {
+                if (entry & PAGE_SWAPPED) {
+                    // The copy gets the area's rights; without an area the
+                    // page is unreachable and is not copied
+                    const vma_t *vma = space ? vma_find(space, (i << 22) | (j << 12)) : NULL;
+                    if (space && !vma) {
+                        continue;
+                    }
+                    uint32_t copy = clone_swapped_page(entry >> 12);
+                    if (!copy) {
+                        failed = 1; // never hand the child a silently zeroed page
+                        continue;
                     }
+                    new_pt[j] = copy | (vma ? vma_page_flags(vma->prot)
+                                            : (PAGE_PRESENT | PAGE_RW | PAGE_USER));
+                    rmap_set(copy, new_pt_phys, j);
                 }
-                
-                // Set up new page directory entry with same flags
-                new_pd[i] = new_pt_phys | (src_pd[i] & 0xFFF);
+                continue;
+            }
+            uint32_t page_phys = entry & ~0xFFFU;
+            page_t *page = pmm_page(page_phys);
+            if (page && !(page->flags & (PG_SHARED | PG_RESERVED)) && (entry & PAGE_RW)) {
+                entry = (entry & ~PAGE_RW) | PAGE_COW;
+                src_pt[j] = entry;
+                flush = 1;
             }
+            // Shared memory (and reserved frames) stay shared and writable
+            pmm_page_get(page_phys);
+            new_pt[j] = entry;
         }
+
+        new_pd[i] = new_pt_phys | (src_pd[i] & 0xFFFU);
     }
     
     // Set up recursive mapping
     new_pd[1023] = new_pd_phys | PAGE_PRESENT | PAGE_RW;
-    
+
+    // The source lost write access to pages it may have cached in the TLB
+    if (flush && src_pd_phys == current_pd_phys) {
+        __asm__ volatile ("mov %0, %%cr3" :: "r"(current_pd_phys) : "memory");
+    }
+
+    // The source keeps its copy-on-write marks; a last sharer just takes
+    // the frame back on its next write
+    if (failed) {
+        paging_destroy_directory(new_pd_phys);
+        return 0;
+    }
     return new_pd_phys;
 }
 
@@ -445,17 +1392,20 @@ void paging_destroy_directory(uint32_t pd_phys)
     
     uint32_t *pd = phys_to_ptr(pd_phys);
     
-    // Free user space page tables and pages
-    for (uint32_t i = 0; i < 768; i++) {
+    // Free user space page tables and pages (the identity map is shared)
+    for (uint32_t i = IDENTITY_PDES; i < USER_PDES; i++) {
         if (pd[i] & PAGE_PRESENT) {
             uint32_t pt_phys = pd[i] & ~0xFFF;
             uint32_t *pt = phys_to_ptr(pt_phys);
             
-            // Free all pages in this page table
+            // Drop this directory's reference to each page; COW and shared
+            // frames survive until their last mapping goes away
             for (uint32_t j = 0; j < 1024; j++) {
                 if (pt[j] & PAGE_PRESENT) {
                     uint32_t page_phys = pt[j] & ~0xFFF;
                     pmm_free_frame(page_phys);
+                } else if (pt[j] & PAGE_SWAPPED) {
+                    swap_free(pt[j] >> 12);
                 }
             }
             
@@ -1,40 +1,191 @@
 #include "mem/pmm.h"
 #include "multiboot.h"
+#include "mem/paging.h"
+#include "mem/memblock.h"
+#include "mem/lru.h"
 #include "ui/console.h"
+#include "arch/x86/cpu.h"
 #include <stdint.h>
 #include <stddef.h>
 
 #define FRAME_SIZE      4096U
 #define PMM_MAX_FRAMES  (1024U * 1024U) /* cover up to 4 GiB */
-#define BITMAP_SIZE     (PMM_MAX_FRAMES / 8)
+
+/*
+ * Buddy allocator state.
+ *
+ * Each order keeps a bitmap with one bit per naturally aligned block of
+ * 2^order frames. A set bit means "this block is free and is exactly this
+ * order" - a free block is only ever recorded at one order, so splitting
+ * and merging move bits between neighbouring levels.
+ *
+ * Every order bitmap is summarised by two more levels: bit w of level 1 is
+ * set while word w of the order bitmap is non-zero, and level 2 does the
+ * same for level 1. Finding the lowest free block is three bsf steps over
+ * at most 32 top-level words instead of a walk over the whole bitmap.
+ */
+#define ORDER_WORDS(order) ((PMM_MAX_FRAMES >> (order)) / 32U)
+#define SUMMARY_WORDS(words) (((words) + 31U) / 32U)
+#define ORDER_STORAGE_WORDS ((PMM_MAX_FRAMES / 32U) * 2U)
+#define SUMMARY_STORAGE_WORDS (ORDER_STORAGE_WORDS / 16U)
+
+/*
+ * Frame descriptors live in a flat array placed directly after the kernel
+ * image, inside the identity-mapped window, so they can be reached both
+ * before and after paging is enabled.
+ */
+#define PAGE_ARRAY_LIMIT 0x01000000U
 
 static uint32_t total_frames = 0;
 static uint32_t free_frames = 0;
 static uint32_t base_usable_frame = 0;
-static uint32_t search_hint = 0;
-static uint8_t frame_bitmap[BITMAP_SIZE];
+static page_t *page_array = NULL;
+
+static uint32_t order_storage[ORDER_STORAGE_WORDS];
+static uint32_t summary_storage[SUMMARY_STORAGE_WORDS];
+static uint32_t *free_area[PMM_MAX_ORDER + 1];
+static uint32_t *summary1[PMM_MAX_ORDER + 1];
+static uint32_t *summary2[PMM_MAX_ORDER + 1];
+static uint32_t free_blocks[PMM_MAX_ORDER + 1];
+
+/*
+ * Zones split the frame range at 16 MiB (legacy DMA / the identity window)
+ * and at PMM_LOWMEM_LIMIT. Both boundaries are multiples of the largest
+ * buddy block, so a block never straddles two zones. Allocations name the
+ * highest zone they can use and fall back downwards from there.
+ */
+static pmm_zone_info_t zones[PMM_ZONE_COUNT];
+static const char *const zone_names[PMM_ZONE_COUNT] = { "DMA", "Normal", "High" };
+
+/*
+ * Pre-zeroed frames. The idle loop tops the pool up to ZERO_POOL_HIGH once
+ * it drops below ZERO_POOL_LOW, so page faults and page-table allocations
+ * usually get a cleared frame without paying for the memset.
+ */
+#define ZERO_POOL_HIGH 64U
+#define ZERO_POOL_LOW  16U
+#define ZERO_POOL_RESERVE 256U /* leave this many frames to the buddy lists */
+
+static uint32_t zero_pool[ZERO_POOL_HIGH];
+static uint32_t zero_pool_count = 0;
+static int zero_pool_refilling = 0;
+static uint32_t zero_pool_hits = 0;
+static uint32_t zero_pool_misses = 0;
 
 extern uint8_t end; /* provided by linker */
 
-static inline void set_frame(uint32_t frame)
+static inline void bit_set(uint32_t *map, uint32_t bit)
+{
+    map[bit >> 5] |= 1U << (bit & 31U);
+}
+
+static inline void bit_clear(uint32_t *map, uint32_t bit)
+{
+    map[bit >> 5] &= ~(1U << (bit & 31U));
+}
+
+static inline uint32_t bsf(uint32_t word)
+{
+    uint32_t index;
+    __asm__ ("bsf %1, %0" : "=r"(index) : "rm"(word));
+    return index;
+}
+
+/* Propagates a word that just went from zero to non-zero up the summaries. */
+static inline void summary_mark(uint32_t order, uint32_t word)
+{
+    uint32_t l1_word = word >> 5;
+    if (summary1[order][l1_word] == 0) {
+        bit_set(summary2[order], l1_word);
+    }
+    bit_set(summary1[order], word);
+}
+
+/* Propagates a word that just became zero up the summaries. */
+static inline void summary_unmark(uint32_t order, uint32_t word)
+{
+    bit_clear(summary1[order], word);
+    if (summary1[order][word >> 5] == 0) {
+        bit_clear(summary2[order], word >> 5);
+    }
+}
+
+static inline void set_block(uint32_t order, uint32_t frame)
+{
+    uint32_t bit = frame >> order;
+    uint32_t word = bit >> 5;
+    if (free_area[order][word] == 0) {
+        summary_mark(order, word);
+    }
+    free_area[order][word] |= 1U << (bit & 31U);
+    ++free_blocks[order];
+}
+
+static inline void clear_block(uint32_t order, uint32_t frame)
 {
-    frame_bitmap[frame >> 3] |= (uint8_t)(1U << (frame & 7U));
+    uint32_t bit = frame >> order;
+    uint32_t word = bit >> 5;
+    free_area[order][word] &= ~(1U << (bit & 31U));
+    if (free_area[order][word] == 0) {
+        summary_unmark(order, word);
+    }
+    --free_blocks[order];
+}
+
+static inline int test_block(uint32_t order, uint32_t frame)
+{
+    uint32_t bit = frame >> order;
+    return (free_area[order][bit >> 5] >> (bit & 31U)) & 1U;
 }
 
-static inline void clear_frame(uint32_t frame)
+/* Marks count consecutive (currently allocated) blocks free, a word at a time. */
+static void set_block_range(uint32_t order, uint32_t frame, uint32_t count)
 {
-    frame_bitmap[frame >> 3] &= (uint8_t)~(1U << (frame & 7U));
+    uint32_t bit = frame >> order;
+    uint32_t last = bit + count;
+    while (bit < last) {
+        uint32_t word = bit >> 5;
+        uint32_t shift = bit & 31U;
+        uint32_t span = 32U - shift;
+        if (span > last - bit) {
+            span = last - bit;
+        }
+        uint32_t mask = (span == 32U) ? 0xFFFFFFFFU : (((1U << span) - 1U) << shift);
+        if (free_area[order][word] == 0) {
+            summary_mark(order, word);
+        }
+        free_blocks[order] += span;
+        free_area[order][word] |= mask;
+        bit += span;
+    }
 }
 
-static inline int test_frame(uint32_t frame)
+static inline void fill_words(void *dst, uint32_t value, uint32_t words)
 {
-    return frame_bitmap[frame >> 3] & (uint8_t)(1U << (frame & 7U));
+    __asm__ volatile ("rep stosl" : "+D"(dst), "+c"(words) : "a"(value) : "memory");
 }
 
-static void bitmap_fill(uint8_t value)
+/* Lays out the order bitmaps and clears only the words that cover RAM. */
+static void setup_free_areas(void)
 {
-    for (size_t i = 0; i < BITMAP_SIZE; ++i) {
-        frame_bitmap[i] = value;
+    uint32_t offset = 0;
+    uint32_t summary_offset = 0;
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; ++order) {
+        uint32_t words = ORDER_WORDS(order);
+        uint32_t l1_words = SUMMARY_WORDS(words);
+        uint32_t used = ((total_frames >> order) + 32U) / 32U;
+        if (used > words) {
+            used = words;
+        }
+        free_area[order] = &order_storage[offset];
+        summary1[order] = &summary_storage[summary_offset];
+        summary2[order] = &summary_storage[summary_offset + l1_words];
+        fill_words(free_area[order], 0, used);
+        fill_words(summary1[order], 0, SUMMARY_WORDS(used));
+        fill_words(summary2[order], 0, SUMMARY_WORDS(SUMMARY_WORDS(used)));
+        offset += words;
+        summary_offset += l1_words + SUMMARY_WORDS(l1_words);
+        free_blocks[order] = 0;
     }
 }
 
@@ -43,113 +194,553 @@ static uint32_t align_frame_up(uint32_t addr)
     return (addr + FRAME_SIZE - 1U) / FRAME_SIZE;
 }
 
-static void release_region(uint64_t base, uint64_t length)
+static inline uint32_t zone_of(uint32_t frame)
 {
-    if (length == 0 || total_frames == 0) {
-        return;
+    if (frame < zones[PMM_ZONE_NORMAL].start) {
+        return PMM_ZONE_DMA;
+    }
+    if (frame < zones[PMM_ZONE_HIGH].start) {
+        return PMM_ZONE_NORMAL;
     }
+    return PMM_ZONE_HIGH;
+}
 
-    uint64_t start = base / FRAME_SIZE;
-    uint64_t end = (base + length + FRAME_SIZE - 1ULL) / FRAME_SIZE;
-    if (start >= end) {
-        return;
+static inline void account_free(uint32_t frame, uint32_t count)
+{
+    free_frames += count;
+    zones[zone_of(frame)].free += count;
+}
+
+static inline void account_alloc(uint32_t frame, uint32_t count)
+{
+    free_frames -= count;
+    zones[zone_of(frame)].free -= count;
+}
+
+/* Frames handed out by the buddy allocator start with one reference. */
+static void init_allocated_pages(uint32_t frame, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        page_t *page = &page_array[frame + i];
+        page->flags = 0;
+        page->count = 1;
+        page->mapping = NULL;
+        page->next = 0;
+        page->prev = 0;
     }
+}
 
-    if (start >= total_frames) {
-        return;
+/* Frames the memory map does not hand to the allocator. */
+static void reserve_pages(uint32_t frame, uint32_t end)
+{
+    for (; frame < end; ++frame) {
+        page_array[frame].flags = PG_RESERVED;
+        page_array[frame].count = 1;
     }
-    if (end > total_frames) {
-        end = total_frames;
+}
+
+/*
+ * Zeroed descriptors describe free frames, so the array is cleared a word
+ * at a time and only the gaps between usable ranges are touched per frame.
+ */
+static void setup_page_array(void)
+{
+    fill_words(page_array, 0, total_frames * (sizeof(page_t) / 4U));
+
+    uint64_t pos = 0, range_base, range_end;
+    uint32_t next = 0;
+    while (next < total_frames && memblock_next_free(&pos, &range_base, &range_end)) {
+        uint32_t first = (uint32_t)((range_base + FRAME_SIZE - 1U) / FRAME_SIZE);
+        uint32_t last = range_end / FRAME_SIZE < total_frames ? (uint32_t)(range_end / FRAME_SIZE) : total_frames;
+        if (first >= last) {
+            continue;
+        }
+        reserve_pages(next, first);
+        next = last;
     }
+    reserve_pages(next, total_frames);
+}
 
-    for (uint32_t frame = (uint32_t)start; frame < (uint32_t)end; ++frame) {
-        if (frame < base_usable_frame) {
-            continue; /* keep firmware/kernel/paging frames reserved */
+static void setup_zones(void)
+{
+    static const uint32_t limits[PMM_ZONE_COUNT] = {
+        PMM_DMA_LIMIT / FRAME_SIZE,
+        PMM_LOWMEM_LIMIT / FRAME_SIZE,
+        PMM_MAX_FRAMES,
+    };
+    uint32_t start = 0;
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; ++z) {
+        uint32_t end = limits[z] < total_frames ? limits[z] : total_frames;
+        if (end < start) {
+            end = start;
         }
-        if (!test_frame(frame)) {
-            continue;
+        zones[z].name = zone_names[z];
+        zones[z].start = start;
+        zones[z].end = end;
+        zones[z].managed = 0;
+        zones[z].free = 0;
+        start = end;
+    }
+}
+
+/*
+ * min is ~1/128 of the zone; low and high add 25% and 50% on top. Ordinary
+ * allocations avoid a zone once it drops under low, reclaim aims for high.
+ */
+static void setup_watermarks(void)
+{
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; ++z) {
+        zones[z].managed = zones[z].free;
+        uint32_t min = zones[z].managed / 128U;
+        if (zones[z].managed && min < 8U) {
+            min = 8U;
         }
-        clear_frame(frame);
-        ++free_frames;
+        zones[z].wmark[PMM_WMARK_MIN] = min;
+        zones[z].wmark[PMM_WMARK_LOW] = min + min / 4U;
+        zones[z].wmark[PMM_WMARK_HIGH] = min + min / 2U;
     }
 }
 
-static uint64_t highest_address_from_mmap(multiboot_info_t *mb_info)
+static void free_block(uint32_t frame, uint32_t order)
 {
-    if (!mb_info || !mb_info->mmap_length) {
-        return 0;
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1U << order);
+        if (buddy + (1U << order) > total_frames || !test_block(order, buddy)) {
+            break;
+        }
+        clear_block(order, buddy);
+        frame &= ~(1U << order);
+        ++order;
     }
+    set_block(order, frame);
+}
 
-    uint64_t max_addr = 0;
-    uint32_t offset = 0;
-    while (offset < mb_info->mmap_length) {
-        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)((uintptr_t)mb_info->mmap_addr + offset);
-        uint64_t entry_end = entry->addr + entry->len;
-        if (entry_end > max_addr) {
-            max_addr = entry_end;
+/* First level-1 summary word at or after w1 with any bit set, or -1. */
+static int32_t next_summary_word(uint32_t order, uint32_t w1)
+{
+    uint32_t l1_words = SUMMARY_WORDS(ORDER_WORDS(order));
+    uint32_t l2_words = SUMMARY_WORDS(l1_words);
+    if (w1 >= l1_words) {
+        return -1;
+    }
+    uint32_t w2 = w1 >> 5;
+    uint32_t bits = summary2[order][w2] & (0xFFFFFFFFU << (w1 & 31U));
+    while (!bits) {
+        if (++w2 >= l2_words) {
+            return -1;
         }
-        offset += entry->size + sizeof(entry->size);
+        bits = summary2[order][w2];
+    }
+    return (int32_t)((w2 << 5) + bsf(bits));
+}
+
+/* Lowest set bit of the order bitmap in [bit, limit), or -1. */
+static int32_t next_free_bit(uint32_t order, uint32_t bit, uint32_t limit)
+{
+    uint32_t words = ORDER_WORDS(order);
+    uint32_t w0 = bit >> 5;
+    if (bit >= limit || w0 >= words) {
+        return -1;
+    }
+    uint32_t bits = free_area[order][w0] & (0xFFFFFFFFU << (bit & 31U));
+    if (!bits) {
+        ++w0;
+        uint32_t w1 = w0 >> 5;
+        uint32_t l1_bits = (w0 < words && (w0 & 31U))
+                         ? summary1[order][w1] & (0xFFFFFFFFU << (w0 & 31U))
+                         : 0;
+        if (!l1_bits) {
+            int32_t next = next_summary_word(order, (w0 & 31U) ? w1 + 1U : w1);
+            if (next < 0) {
+                return -1;
+            }
+            w1 = (uint32_t)next;
+            l1_bits = summary1[order][w1];
+        }
+        w0 = (w1 << 5) + bsf(l1_bits);
+        bits = free_area[order][w0];
+    }
+    uint32_t found = (w0 << 5) + bsf(bits);
+    return found < limit ? (int32_t)found : -1;
+}
+
+/* Finds the lowest free block of exactly this order inside a zone, or -1. */
+static int32_t take_block(uint32_t order, uint32_t zone)
+{
+    if (free_blocks[order] == 0 || zones[zone].free < (1U << order)) {
+        return -1;
+    }
+    uint32_t limit = (zones[zone].end + (1U << order) - 1U) >> order;
+    int32_t bit = next_free_bit(order, zones[zone].start >> order, limit);
+    if (bit < 0) {
+        return -1;
     }
-    return max_addr;
+    uint32_t frame = (uint32_t)bit << order;
+    clear_block(order, frame);
+    return (int32_t)frame;
 }
 
-static void process_available_regions(multiboot_info_t *mb_info)
+/* Buddy allocation restricted to one zone. */
+static uint32_t zone_alloc(uint32_t order, uint32_t zone)
 {
-    if (!mb_info || !mb_info->mmap_length) {
-        release_region((uint64_t)base_usable_frame * FRAME_SIZE,
-                       ((uint64_t)total_frames - base_usable_frame) * FRAME_SIZE);
+    for (uint32_t current = order; current <= PMM_MAX_ORDER; ++current) {
+        int32_t block = take_block(current, zone);
+        if (block < 0) {
+            continue;
+        }
+        uint32_t frame = (uint32_t)block;
+        /* Split down to the requested size, returning upper halves. */
+        while (current > order) {
+            --current;
+            set_block(current, frame + (1U << current));
+        }
+        account_alloc(frame, 1U << order);
+        init_allocated_pages(frame, 1U << order);
+        return frame * FRAME_SIZE;
+    }
+    return 0;
+}
+
+/*
+ * Frees one memblock range. Ranges are disjoint and were never free, so
+ * runs of whole max-order blocks are set a word at a time and only the
+ * unaligned head and tail go through free_block().
+ */
+static void release_region(uint64_t base, uint64_t end)
+{
+    uint64_t first = (base + FRAME_SIZE - 1ULL) / FRAME_SIZE;
+    uint64_t last = end / FRAME_SIZE;
+    if (last > total_frames) {
+        last = total_frames;
+    }
+    if (first >= last) {
         return;
     }
 
-    uint32_t offset = 0;
-    while (offset < mb_info->mmap_length) {
-        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)((uintptr_t)mb_info->mmap_addr + offset);
-        if (entry->type == 1) {
-            release_region(entry->addr, entry->len);
+    uint32_t frame = (uint32_t)first;
+    uint32_t stop = (uint32_t)last;
+    const uint32_t max_block = 1U << PMM_MAX_ORDER;
+    while (frame < stop) {
+        if (!(frame & (max_block - 1U))) {
+            uint32_t limit = zones[zone_of(frame)].end < stop ? zones[zone_of(frame)].end : stop;
+            uint32_t count = (limit - frame) >> PMM_MAX_ORDER;
+            if (count > 1) {
+                set_block_range(PMM_MAX_ORDER, frame, count);
+                account_free(frame, count * max_block);
+                frame += count * max_block;
+                continue;
+            }
+        }
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               ((frame & ((1U << order) - 1U)) || frame + (1U << order) > stop)) {
+            --order;
         }
-        offset += entry->size + sizeof(entry->size);
+        free_block(frame, order);
+        account_free(frame, 1U << order);
+        frame += 1U << order;
     }
 }
 
-uint32_t pmm_alloc_frame(void)
+/*
+ * Records usable RAM (below 4 GiB) and the boot-time reservations. Returns
+ * the amount of RAM above 4 GiB, which 32-bit paging cannot reach.
+ */
+static uint64_t memblock_setup(multiboot_info_t *mb_info, uint32_t reserve_end)
 {
-    if (free_frames == 0 || total_frames == 0) {
+    uint64_t beyond = 0;
+    const uint64_t limit = (uint64_t)PMM_MAX_FRAMES * FRAME_SIZE;
+    if (mb_info && mb_info->mmap_length) {
+        uint32_t offset = 0;
+        while (offset < mb_info->mmap_length) {
+            multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)((uintptr_t)mb_info->mmap_addr + offset);
+            if (entry->type == 1 && entry->addr + entry->len > limit) {
+                beyond += entry->addr >= limit ? entry->len : entry->addr + entry->len - limit;
+            }
+            if (entry->type == 1 && entry->addr < limit) {
+                uint64_t len = entry->len;
+                if (entry->addr + len > limit) {
+                    len = limit - entry->addr;
+                }
+                memblock_add(entry->addr, len);
+            }
+            offset += entry->size + sizeof(entry->size);
+        }
+    } else if (mb_info) {
+        memblock_add(0, (uint64_t)mb_info->mem_lower * 1024ULL);
+        memblock_add(0x00100000U, (uint64_t)mb_info->mem_upper * 1024ULL);
+    }
+    /* Firmware area below 1 MiB and the kernel image. */
+    memblock_reserve(0, reserve_end);
+    return beyond;
+}
+
+/*
+ * Pass 0 keeps every zone above its low watermark, pass 1 dips to min,
+ * pass 2 takes whatever is left; passes limits how far to go. Within a
+ * pass, higher zones go first so DMA/identity-mapped memory is the last to
+ * be handed out.
+ */
+static uint32_t alloc_frames_zone(uint32_t order, uint32_t zone, uint32_t passes)
+{
+    if (order > PMM_MAX_ORDER || zone >= PMM_ZONE_COUNT || free_frames < (1U << order)) {
         return 0;
     }
 
-    uint32_t start = search_hint;
-    for (int pass = 0; pass < 2; ++pass) {
-        uint32_t begin = (pass == 0) ? start : base_usable_frame;
-        uint32_t end = (pass == 0) ? total_frames : start;
-        for (uint32_t frame = begin; frame < end; ++frame) {
-            if (!test_frame(frame)) {
-                set_frame(frame);
-                --free_frames;
-                search_hint = frame;
-                return frame * FRAME_SIZE;
+    for (uint32_t mark = 0; mark < passes; ++mark) {
+        for (int32_t z = (int32_t)zone; z >= 0; --z) {
+            uint32_t reserve = 0;
+            if (mark == 0) {
+                reserve = zones[z].wmark[PMM_WMARK_LOW];
+            } else if (mark == 1) {
+                reserve = zones[z].wmark[PMM_WMARK_MIN];
+            }
+            if (zones[z].free < reserve + (1U << order)) {
+                continue;
+            }
+            uint32_t addr = zone_alloc(order, (uint32_t)z);
+            if (addr) {
+                return addr;
             }
         }
     }
     return 0;
 }
 
-void pmm_free_frame(uint32_t addr)
+uint32_t pmm_alloc_frames(uint32_t order)
+{
+    return pmm_alloc_frames_zone(order, PMM_ZONE_HIGH);
+}
+
+void pmm_free_frames(uint32_t addr, uint32_t order)
 {
-    if (addr == 0) {
+    if (addr == 0 || order > PMM_MAX_ORDER) {
         return;
     }
     uint32_t frame = addr / FRAME_SIZE;
-    if (frame < base_usable_frame || frame >= total_frames) {
+    if (frame & ((1U << order) - 1U)) {
+        return; /* not a block head */
+    }
+    if (frame < base_usable_frame || frame + (1U << order) > total_frames) {
         return;
     }
-    if (!test_frame(frame)) {
+    uint32_t count = 1U << order;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (page_array[frame + i].count == 0) {
+            console_write("pmm: double free of frame ");
+            console_write_hex((frame + i) * FRAME_SIZE);
+            console_write("\n");
+            return;
+        }
+    }
+
+    /* Drop one reference per frame; only frames that reach zero are freed. */
+    uint32_t released = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        page_t *page = &page_array[frame + i];
+        if (!(page->flags & PG_RESERVED) && --page->count == 0) {
+            if (page->flags & PG_LRU) {
+                lru_del(page);
+            }
+            page->flags = 0;
+            page->mapping = NULL;
+            ++released;
+        }
+    }
+    if (released == count) {
+        free_block(frame, order);
+        account_free(frame, count);
         return;
     }
-    clear_frame(frame);
-    ++free_frames;
-    if (frame < search_hint) {
-        search_hint = frame;
+    for (uint32_t i = 0; i < count && released; ++i) {
+        if (page_array[frame + i].count == 0) {
+            free_block(frame + i, 0);
+            account_free(frame + i, 1);
+            --released;
+        }
+    }
+}
+
+/* Pops the most recently zeroed pool frame that lies in zone or below, or 0. */
+static uint32_t zero_pool_take(uint32_t zone)
+{
+    uint32_t frame = 0;
+    uint32_t irq = cpu_save_irq();
+    for (uint32_t i = zero_pool_count; i > 0; --i) {
+        if (zone_of(zero_pool[i - 1] / FRAME_SIZE) <= zone) {
+            frame = zero_pool[i - 1];
+            zero_pool[i - 1] = zero_pool[--zero_pool_count];
+            break;
+        }
+    }
+    cpu_restore_irq(irq);
+    return frame;
+}
+
+uint32_t pmm_alloc_frames_zone(uint32_t order, uint32_t zone)
+{
+    return alloc_frames_zone(order, zone, 3);
+}
+
+uint32_t pmm_alloc_frame_zone(uint32_t zone)
+{
+    uint32_t frame = pmm_alloc_frames_zone(0, zone);
+    if (frame == 0) {
+        /* Out of memory: pre-zeroed frames are still ordinary free frames. */
+        frame = zero_pool_take(zone);
+    }
+    return frame;
+}
+
+uint32_t pmm_alloc_frame(void)
+{
+    return pmm_alloc_frame_zone(PMM_ZONE_HIGH);
+}
+
+static uint32_t alloc_zeroed_frame_zone(uint32_t zone, uint32_t passes)
+{
+    uint32_t frame = zero_pool_take(zone);
+    if (frame) {
+        ++zero_pool_hits;
+        return frame;
+    }
+    ++zero_pool_misses;
+
+    frame = alloc_frames_zone(0, zone, passes);
+    if (frame) {
+        paging_zero_frame(frame);
+    }
+    return frame;
+}
+
+uint32_t pmm_alloc_zeroed_frame_zone(uint32_t zone)
+{
+    return alloc_zeroed_frame_zone(zone, 3);
+}
+
+uint32_t pmm_try_alloc_frame_zone(uint32_t zone)
+{
+    return alloc_frames_zone(0, zone, 1);
+}
+
+uint32_t pmm_try_alloc_zeroed_frame_zone(uint32_t zone)
+{
+    if (!pmm_watermark_ok(zone, PMM_WMARK_LOW)) {
+        return 0; /* the pool is part of the reserve once memory is this low */
+    }
+    return alloc_zeroed_frame_zone(zone, 1);
+}
+
+uint32_t pmm_alloc_zeroed_frame(void)
+{
+    return pmm_alloc_zeroed_frame_zone(PMM_ZONE_HIGH);
+}
+
+uint32_t pmm_zero_pool_refill(uint32_t budget)
+{
+    if (!zero_pool_refilling) {
+        if (zero_pool_count >= ZERO_POOL_LOW) {
+            return 0;
+        }
+        zero_pool_refilling = 1;
+    }
+
+    uint32_t zeroed = 0;
+    while (zeroed < budget && zero_pool_count < ZERO_POOL_HIGH && free_frames > ZERO_POOL_RESERVE) {
+        uint32_t irq = cpu_save_irq();
+        uint32_t frame = pmm_try_alloc_frame_zone(PMM_ZONE_HIGH); /* never below low */
+        cpu_restore_irq(irq);
+        if (!frame) {
+            break;
+        }
+        /* Interrupts stay on while zeroing unless the frame is high memory,
+           outside the physmap: then the scratch slot needs them off for the
+           4 KiB memset. Either way they get in between frames. */
+        paging_zero_frame(frame);
+        irq = cpu_save_irq();
+        if (zero_pool_count < ZERO_POOL_HIGH) {
+            zero_pool[zero_pool_count++] = frame;
+            frame = 0;
+        }
+        cpu_restore_irq(irq);
+        if (frame) {
+            pmm_free_frame(frame);
+            break;
+        }
+        ++zeroed;
+    }
+
+    if (zeroed < budget) {
+        zero_pool_refilling = 0; /* full, or memory is too tight to hold frames back */
+    }
+    return zeroed;
+}
+
+void pmm_zero_pool_stats(uint32_t *available, uint32_t *hits, uint32_t *misses)
+{
+    if (available) *available = zero_pool_count;
+    if (hits) *hits = zero_pool_hits;
+    if (misses) *misses = zero_pool_misses;
+}
+
+void pmm_free_frame(uint32_t addr)
+{
+    pmm_free_frames(addr, 0);
+}
+
+int pmm_watermark_ok(uint32_t zone, uint32_t mark)
+{
+    uint32_t free = 0, reserve = 0;
+    if (zone >= PMM_ZONE_COUNT) {
+        zone = PMM_ZONE_HIGH;
+    }
+    for (uint32_t z = 0; z <= zone; ++z) {
+        free += zones[z].free;
+        reserve += zones[z].wmark[mark];
+    }
+    return free > reserve;
+}
+
+uint32_t pmm_frame_zone(uint32_t addr)
+{
+    return zone_of(addr / FRAME_SIZE);
+}
+
+int pmm_zone_info(uint32_t zone, pmm_zone_info_t *out)
+{
+    if (zone >= PMM_ZONE_COUNT || !out) {
+        return -1;
+    }
+    *out = zones[zone];
+    return 0;
+}
+
+page_t *pmm_page(uint32_t addr)
+{
+    uint32_t frame = addr / FRAME_SIZE;
+    if (!page_array || frame >= total_frames) {
+        return NULL;
     }
+    return &page_array[frame];
+}
+
+uint32_t pmm_page_addr(const page_t *page)
+{
+    return (uint32_t)(page - page_array) * FRAME_SIZE;
+}
+
+void pmm_page_get(uint32_t addr)
+{
+    page_t *page = pmm_page(addr);
+    if (page && !(page->flags & PG_RESERVED)) {
+        ++page->count;
+    }
+}
+
+uint32_t pmm_page_count(uint32_t addr)
+{
+    page_t *page = pmm_page(addr);
+    return page ? page->count : 0;
 }
 
 uint32_t pmm_total_memory(void)
@@ -157,8 +748,14 @@ uint32_t pmm_total_memory(void)
     return total_frames * FRAME_SIZE;
 }
 
+uint32_t pmm_free_memory(void)
+{
+    return free_frames * FRAME_SIZE;
+}
+
 void pmm_init(multiboot_info_t *mb_info)
 {
+    uint64_t start_tsc = cpu_rdtsc();
     uint32_t kernel_end_phys = (uint32_t)(uintptr_t)&end;
     uint32_t reserve_floor = align_frame_up(kernel_end_phys);
     uint32_t minimum_bootstrap = align_frame_up(0x00100000U); /* keep first MiB reserved */
@@ -166,28 +763,71 @@ void pmm_init(multiboot_info_t *mb_info)
         reserve_floor = minimum_bootstrap;
     }
     base_usable_frame = reserve_floor;
-    search_hint = base_usable_frame;
-
-    uint64_t max_addr = highest_address_from_mmap(mb_info);
-    if (max_addr == 0) {
-        if (mb_info) {
-            max_addr = ((uint64_t)mb_info->mem_lower + (uint64_t)mb_info->mem_upper) * 1024ULL;
-        }
-    }
-    total_frames = (uint32_t)(max_addr / FRAME_SIZE);
-    if (total_frames > PMM_MAX_FRAMES) {
-        total_frames = PMM_MAX_FRAMES;
+    uint64_t beyond_4g = memblock_setup(mb_info, reserve_floor * FRAME_SIZE);
+    if (beyond_4g) {
+        console_write("PMM: ");
+        console_write_dec((uint32_t)(beyond_4g >> 20));
+        console_write(" MiB of RAM above 4 GiB is not addressable without PAE\n");
     }
+
+    /* Only usable RAM counts: firmware ranges near 4 GiB would inflate everything. */
+    total_frames = (uint32_t)(memblock_end_of_ram() / FRAME_SIZE);
     if (total_frames < base_usable_frame) {
         total_frames = base_usable_frame;
     }
 
-    bitmap_fill(0xFF); /* mark everything reserved */
+    /* The descriptor array must sit in the identity window. */
+    uint32_t array_phys;
+    while ((array_phys = memblock_alloc(total_frames * sizeof(page_t), FRAME_SIZE,
+                                        PAGE_ARRAY_LIMIT)) == 0 && total_frames > base_usable_frame) {
+        total_frames -= total_frames / 8U;
+    }
+    if (array_phys == 0) {
+        console_write("PMM: no room for frame descriptors\n");
+        for (;;) {
+            __asm__ volatile ("cli; hlt");
+        }
+    }
+    if ((uint64_t)total_frames * FRAME_SIZE < memblock_end_of_ram()) {
+        console_write("PMM: memory above ");
+        console_write_hex(total_frames * FRAME_SIZE);
+        console_write(" ignored (no room for frame descriptors)\n");
+    }
+    page_array = (page_t *)(uintptr_t)array_phys;
+
+    setup_free_areas(); /* everything starts out reserved */
+    setup_zones();
+    setup_page_array();
     free_frames = 0;
 
-    process_available_regions(mb_info);
+    uint64_t pos = 0, range_base, range_end;
+    while (memblock_next_free(&pos, &range_base, &range_end)) {
+        release_region(range_base, range_end);
+    }
+    setup_watermarks();
 
     console_write("PMM initialized. Frames: ");
     console_write_dec(total_frames);
-    console_write("\n");
+    console_write(" (free ");
+    console_write_dec(free_frames);
+    console_write(")\n");
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; ++z) {
+        if (!zones[z].managed) {
+            continue;
+        }
+        console_write("  Zone ");
+        console_write(zones[z].name);
+        console_write(": ");
+        console_write_dec(zones[z].managed);
+        console_write(" frames, watermarks ");
+        console_write_dec(zones[z].wmark[PMM_WMARK_MIN]);
+        console_write("/");
+        console_write_dec(zones[z].wmark[PMM_WMARK_LOW]);
+        console_write("/");
+        console_write_dec(zones[z].wmark[PMM_WMARK_HIGH]);
+        console_write("\n");
+    }
+    console_write("  Setup took ");
+    console_write_dec((uint32_t)((cpu_rdtsc() - start_tsc) >> 10));
+    console_write("K cycles\n");
 }
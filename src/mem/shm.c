@@ -2,6 +2,7 @@
 #include <mem/pmm.h>
 #include <mem/paging.h>
 #include <mem/heap.h>
+#include <mem/vma.h>
 #include <ui/console.h>
 #include <string.h>
 
@@ -61,40 +62,46 @@ int shm_get(uint32_t key, uint32_t size, int flags) {
         return -1; // ENOMEM (slots)
     }
     
-    // Allocate physical memory
-    // For simplicity, we allocate contiguous physical frames. 
-    // In a real OS, we might handle non-contiguous pages, but that requires storing a list of pages.
-    // Here we just try to alloc N frames.
-    // Note: pmm_alloc_frame returns 1 frame. We need N.
-    // Our PMM is simple. Let's just alloc N separate frames and store them?
-    // Storing them requires a list.
-    // To keep it simple for this implementation: We will allocate contiguous frames if possible,
-    // OR we will limit SHM to 1 page for now? No, that's too limited.
-    // Let's implement a simple page list for the region.
-    // Actually, `shm_region_t` is fixed size.
-    // Let's assume for now we only support 1 page SHM for simplicity of the struct, 
-    // OR we dynamically allocate the page list.
-    
-    // Let's use `kmalloc` to store the list of physical pages.
+    // Allocate physical memory, keeping a kmalloc'd list of the frames.
     uint32_t pages_needed = (size + PAGE_SIZE - 1) / PAGE_SIZE;
     uint32_t *phys_pages = (uint32_t *)kmalloc(pages_needed * sizeof(uint32_t));
     if (!phys_pages) return -1;
     
-    for (uint32_t i = 0; i < pages_needed; i++) {
-        uint32_t frame = pmm_alloc_frame();
-        if (!frame) {
-            // Rollback
-            for (uint32_t j = 0; j < i; j++) {
-                pmm_free_frame(phys_pages[j]);
+    // Prefer one physically contiguous buddy block; the unused tail of the
+    // power-of-two block goes straight back to the PMM.
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && (1U << order) < pages_needed) {
+        order++;
+    }
+    uint32_t block = ((1U << order) >= pages_needed) ? pmm_alloc_frames(order) : 0;
+    if (block) {
+        for (uint32_t i = 0; i < pages_needed; i++) {
+            phys_pages[i] = block + i * PAGE_SIZE;
+        }
+        for (uint32_t i = pages_needed; i < (1U << order); i++) {
+            pmm_free_frame(block + i * PAGE_SIZE);
+        }
+    } else {
+        for (uint32_t i = 0; i < pages_needed; i++) {
+            uint32_t frame = pmm_alloc_frame();
+            if (!frame) {
+                // Rollback
+                for (uint32_t j = 0; j < i; j++) {
+                    pmm_free_frame(phys_pages[j]);
+                }
+                kfree(phys_pages);
+                return -1;
             }
-            kfree(phys_pages);
-            return -1;
+            phys_pages[i] = frame;
         }
-        phys_pages[i] = frame;
-        // Zero the memory for security
-        // We need to map it temporarily to zero it? 
-        // Or just trust pmm_alloc_frame (which doesn't zero).
-        // Let's skip zeroing for now or rely on user to init.
+    }
+    // Frames are not zeroed here; the user is expected to initialise them.
+
+    // The region keeps the allocation reference; each attach adds one.
+    for (uint32_t i = 0; i < pages_needed; i++) {
+        page_t *page = pmm_page(phys_pages[i]);
+        page->flags |= PG_SHARED;
+        page->mapping = region;
     }
     
     // We need to store this list. We can't put it in the fixed struct easily.
@@ -126,40 +133,65 @@ void *shm_attach(int id, void *addr, int flags) {
     if (!region) return NULL;
     
     uint32_t virt_start;
-    if (addr) {
-        virt_start = (uint32_t)addr;
+    uint32_t size = region->pages * PAGE_SIZE;
+    vm_space_t *space = vma_current_space();
+    if (space) {
+        // The range is recorded as an area so faults and munmap know it
+        virt_start = addr ? ((uint32_t)addr & ~(PAGE_SIZE - 1)) : vma_find_free(space, size);
+        if (!virt_start ||
+            vma_insert(space, virt_start, size, VMA_READ | VMA_WRITE, VMA_SHM, region->id) != 0) {
+            return NULL;
+        }
+    } else if (addr) {
+        virt_start = (uint32_t)addr & ~(PAGE_SIZE - 1);
     } else {
-        // Find a free virtual address region?
-        // For now, let's require the user to provide an address or pick a fixed one.
-        // We don't have a VMA allocator yet.
-        // Let's pick a high address in user space, e.g., 0xA0000000 + id * 1MB
+        // Kernel tasks have no areas: pick a fixed high address per id
         virt_start = 0xA0000000 + (id * 0x100000); 
     }
     
-    // Align
-    virt_start &= ~(PAGE_SIZE - 1);
-    
     uint32_t *phys_pages = (uint32_t *)region->phys_start;
     
-    // Map pages
+    // Map with User + RW permissions
+    // This maintains page-level protection: only this specific virtual range
+    // is mapped to these physical pages.
+    paging_map_frames(virt_start, phys_pages, region->pages, PAGE_USER | PAGE_RW | PAGE_PRESENT);
     for (uint32_t i = 0; i < region->pages; i++) {
-        uint32_t phys = phys_pages[i];
-        uint32_t virt = virt_start + (i * PAGE_SIZE);
-        
-        // Map with User + RW permissions
-        // This maintains page-level protection: only this specific virtual range
-        // is mapped to these physical pages.
-        paging_map(virt, phys, PAGE_USER | PAGE_RW | PAGE_PRESENT);
+        pmm_page_get(phys_pages[i]);
     }
     
-    region->ref_count++;
+    if (!space) {
+        region->ref_count++; // with a space, vma_insert counted the area
+    }
     return (void *)virt_start;
 }
 
 int shm_detach(void *addr) {
-    // Unmapping requires knowing the size.
-    // Since we don't track per-process attachments in this simple version,
-    // we can't easily unmap just by address without searching.
-    // For now, stub.
+    // Attachments are only tracked for tasks with an address space
+    vm_space_t *space = vma_current_space();
+    const vma_t *vma = space ? vma_find(space, (uint32_t)addr) : NULL;
+    if (!vma || vma->kind != VMA_SHM || vma->start != (uint32_t)addr) {
+        return -1;
+    }
+    uint32_t start = vma->start;
+    uint32_t size = vma->end - vma->start;
+
+    // Drops the references shm_attach took on the frames; removing the
+    // area drops the region reference
+    paging_unmap_range(start, size / PAGE_SIZE, 1);
+    vma_remove(space, start, size);
     return 0;
 }
+
+void shm_region_get(uint32_t id) {
+    shm_region_t *region = find_region_by_id((int)id);
+    if (region) {
+        region->ref_count++;
+    }
+}
+
+void shm_region_put(uint32_t id) {
+    shm_region_t *region = find_region_by_id((int)id);
+    if (region && region->ref_count > 0) {
+        region->ref_count--;
+    }
+}
@@ -0,0 +1,359 @@
+#include "mem/slab.h"
+#include "mem/pmm.h"
+#include "mem/paging.h"
+#include "ui/console.h"
+#include "arch/x86/cpu.h"
+
+#define SLAB_START 0xF1000000U /* right after the heap */
+#define SLAB_SIZE  (16 * 1024 * 1024)
+#define SLAB_PAGES (SLAB_SIZE / PAGE_SIZE)
+
+#define SLAB_MAX_PAGES   8U  /* largest slab: 32 KiB */
+#define SLAB_MIN_OBJECTS 8U  /* grow the slab size until this many objects fit */
+#define SLAB_KEEP_EMPTY  1U  /* empty slabs a cache holds on to before freeing */
+#define KMALLOC_CACHES   9   /* 8, 16, ... 2048 */
+#define MAX_CACHES       32
+
+/*
+ * A slab is 1-8 virtually contiguous pages in the slab window. Objects are
+ * packed from the start of the first page, so power-of-two objects are
+ * naturally aligned; the slab header sits in the last bytes of the slab.
+ * Free objects hold the freelist link in their first word.
+ */
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    kmem_cache_t *cache;
+    void *freelist;
+    uint32_t inuse;
+    uint32_t base;
+} slab_t;
+
+typedef struct {
+    slab_t *head;
+    uint32_t count;
+} slab_list_t;
+
+struct kmem_cache {
+    const char *name;
+    uint32_t object_size;  /* stride, already rounded up to the alignment */
+    uint32_t pages;        /* per slab */
+    uint32_t per_slab;
+    slab_list_t partial;
+    slab_list_t full;
+    slab_list_t empty;
+    uint32_t active;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t grows;
+    uint32_t shrinks;
+    int used;
+};
+
+static kmem_cache_t caches[MAX_CACHES];
+static const char *const kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+/* Slab window bookkeeping: which pages are in use and the slab owning each. */
+static uint32_t window_map[SLAB_PAGES / 32];
+static slab_t *page_owner[SLAB_PAGES];
+static uint32_t window_hint = 0;
+
+static void list_add(slab_list_t *list, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = list->head;
+    if (list->head) {
+        list->head->prev = slab;
+    }
+    list->head = slab;
+    ++list->count;
+}
+
+static void list_del(slab_list_t *list, slab_t *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        list->head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+    --list->count;
+}
+
+/* Finds pages free, naturally aligned window pages. pages is a power of two <= 32. */
+static int32_t window_alloc(uint32_t pages)
+{
+    uint32_t mask = (pages == 32U) ? 0xFFFFFFFFU : ((1U << pages) - 1U);
+    for (uint32_t n = 0; n < SLAB_PAGES / 32; ++n) {
+        uint32_t word = (window_hint + n) % (SLAB_PAGES / 32);
+        if (window_map[word] == 0xFFFFFFFFU) {
+            continue;
+        }
+        for (uint32_t shift = 0; shift < 32; shift += pages) {
+            if (!(window_map[word] & (mask << shift))) {
+                window_map[word] |= mask << shift;
+                window_hint = word;
+                return (int32_t)(word * 32U + shift);
+            }
+        }
+    }
+    return -1;
+}
+
+static void window_free(uint32_t first, uint32_t pages)
+{
+    for (uint32_t i = first; i < first + pages; ++i) {
+        window_map[i >> 5] &= ~(1U << (i & 31U));
+        page_owner[i] = NULL;
+    }
+}
+
+static void slab_unmap(uint32_t base, uint32_t pages)
+{
+    paging_unmap_range(base, pages, 1);
+}
+
+static slab_t *slab_grow(kmem_cache_t *cache)
+{
+    int32_t first = window_alloc(cache->pages);
+    if (first < 0) {
+        return NULL;
+    }
+    uint32_t base = SLAB_START + (uint32_t)first * PAGE_SIZE;
+    uint32_t frames[SLAB_MAX_PAGES];
+    for (uint32_t i = 0; i < cache->pages; ++i) {
+        frames[i] = pmm_alloc_frame();
+        if (!frames[i]) {
+            while (i-- > 0) {
+                pmm_free_frame(frames[i]);
+            }
+            window_free((uint32_t)first, cache->pages);
+            return NULL;
+        }
+    }
+    paging_map_frames(base, frames, cache->pages, PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL);
+
+    slab_t *slab = (slab_t *)(base + cache->pages * PAGE_SIZE - sizeof(slab_t));
+    slab->cache = cache;
+    slab->base = base;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+    for (uint32_t i = cache->per_slab; i > 0; --i) {
+        void **obj = (void **)(base + (i - 1U) * cache->object_size);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+    }
+    for (uint32_t i = 0; i < cache->pages; ++i) {
+        page_owner[first + i] = slab;
+    }
+    ++cache->grows;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t *cache, slab_t *slab)
+{
+    uint32_t base = slab->base;
+    slab_unmap(base, cache->pages);
+    window_free((base - SLAB_START) / PAGE_SIZE, cache->pages);
+    ++cache->shrinks;
+}
+
+static void cache_setup(kmem_cache_t *cache, const char *name, uint32_t size, uint32_t align)
+{
+    if (size < sizeof(void *)) {
+        size = sizeof(void *);
+    }
+    size = (size + align - 1U) & ~(align - 1U);
+
+    uint32_t pages = 1;
+    while (pages < SLAB_MAX_PAGES &&
+           (pages * PAGE_SIZE - sizeof(slab_t)) / size < SLAB_MIN_OBJECTS) {
+        pages <<= 1;
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->pages = pages;
+    cache->per_slab = (pages * PAGE_SIZE - sizeof(slab_t)) / size;
+    cache->partial.head = cache->full.head = cache->empty.head = NULL;
+    cache->partial.count = cache->full.count = cache->empty.count = 0;
+    cache->active = cache->allocs = cache->frees = 0;
+    cache->grows = cache->shrinks = 0;
+    cache->used = 1;
+}
+
+void slab_init(void)
+{
+    /* Every directory created from now on shares these tables. */
+    paging_reserve_kernel_tables(SLAB_START, SLAB_SIZE);
+    for (uint32_t i = 0; i < KMALLOC_CACHES; ++i) {
+        uint32_t size = SLAB_MIN_SIZE << i;
+        cache_setup(&caches[i], kmalloc_names[i], size, size < PAGE_SIZE ? size : PAGE_SIZE);
+    }
+    console_write("Slab allocator ready (kmalloc-8 .. kmalloc-2048).\n");
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align)
+{
+    if (align == 0) {
+        align = sizeof(void *);
+    }
+    if (size == 0 || (align & (align - 1U)) || align > PAGE_SIZE ||
+        size > SLAB_MAX_PAGES * PAGE_SIZE - sizeof(slab_t)) {
+        return NULL;
+    }
+    uint32_t irq = cpu_save_irq();
+    kmem_cache_t *cache = NULL;
+    for (uint32_t i = KMALLOC_CACHES; i < MAX_CACHES; ++i) {
+        if (!caches[i].used) {
+            cache = &caches[i];
+            cache_setup(cache, name, (uint32_t)size, (uint32_t)align);
+            break;
+        }
+    }
+    cpu_restore_irq(irq);
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+    uint32_t irq = cpu_save_irq();
+    slab_t *slab = cache->partial.head;
+    if (!slab) {
+        slab = cache->empty.head;
+        if (slab) {
+            list_del(&cache->empty, slab);
+        } else {
+            slab = slab_grow(cache);
+            if (!slab) {
+                cpu_restore_irq(irq);
+                return NULL;
+            }
+        }
+        list_add(&cache->partial, slab);
+    }
+
+    void **obj = (void **)slab->freelist;
+    slab->freelist = *obj;
+    if (++slab->inuse == cache->per_slab) {
+        list_del(&cache->partial, slab);
+        list_add(&cache->full, slab);
+    }
+    ++cache->active;
+    ++cache->allocs;
+    cpu_restore_irq(irq);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+    if (!obj) {
+        return;
+    }
+    uint32_t addr = (uint32_t)obj;
+    slab_t *slab = NULL;
+    if (addr >= SLAB_START && addr < SLAB_START + SLAB_SIZE) {
+        slab = page_owner[(addr - SLAB_START) / PAGE_SIZE];
+    }
+    if (!slab || slab->cache != cache || (addr - slab->base) % cache->object_size ||
+        (addr - slab->base) / cache->object_size >= cache->per_slab) {
+        console_write("kmem_cache_free: bad object ");
+        console_write_hex(addr);
+        console_write("\n");
+        return;
+    }
+
+    uint32_t irq = cpu_save_irq();
+    if (slab->inuse == cache->per_slab) {
+        list_del(&cache->full, slab);
+        list_add(&cache->partial, slab);
+    }
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    if (--slab->inuse == 0) {
+        list_del(&cache->partial, slab);
+        if (cache->empty.count < SLAB_KEEP_EMPTY) {
+            list_add(&cache->empty, slab);
+        } else {
+            slab_release(cache, slab);
+        }
+    }
+    --cache->active;
+    ++cache->frees;
+    cpu_restore_irq(irq);
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache)
+{
+    if (!cache || cache < &caches[KMALLOC_CACHES] || cache >= &caches[MAX_CACHES]) {
+        return;
+    }
+    uint32_t irq = cpu_save_irq();
+    if (cache->partial.count || cache->full.count) {
+        cpu_restore_irq(irq);
+        console_write("kmem_cache_destroy: ");
+        console_write(cache->name);
+        console_write(" still has objects in use\n");
+        return;
+    }
+    while (cache->empty.head) {
+        slab_t *slab = cache->empty.head;
+        list_del(&cache->empty, slab);
+        slab_release(cache, slab);
+    }
+    cache->used = 0;
+    cpu_restore_irq(irq);
+}
+
+kmem_cache_t *kmalloc_cache(size_t size)
+{
+    if (size > SLAB_MAX_SIZE) {
+        return NULL;
+    }
+    if (size <= SLAB_MIN_SIZE) {
+        return &caches[0];
+    }
+    /* Index of the next power of two, counted from 8 bytes. */
+    return &caches[29 - __builtin_clz((uint32_t)size - 1U)];
+}
+
+kmem_cache_t *slab_cache_of(const void *obj)
+{
+    uint32_t addr = (uint32_t)obj;
+    if (addr < SLAB_START || addr >= SLAB_START + SLAB_SIZE) {
+        return NULL;
+    }
+    slab_t *slab = page_owner[(addr - SLAB_START) / PAGE_SIZE];
+    return slab ? slab->cache : NULL;
+}
+
+int kmem_cache_info(uint32_t index, kmem_cache_info_t *out)
+{
+    for (uint32_t i = 0; i < MAX_CACHES; ++i) {
+        if (!caches[i].used) {
+            continue;
+        }
+        if (index-- != 0) {
+            continue;
+        }
+        kmem_cache_t *cache = &caches[i];
+        out->name = cache->name;
+        out->object_size = cache->object_size;
+        out->objects_per_slab = cache->per_slab;
+        out->slabs = cache->partial.count + cache->full.count + cache->empty.count;
+        out->active_objects = cache->active;
+        out->allocs = cache->allocs;
+        out->frees = cache->frees;
+        out->grows = cache->grows;
+        out->shrinks = cache->shrinks;
+        return 0;
+    }
+    return -1;
+}
@@ -1,4 +1,5 @@
 #include <mem/swap.h>
+#include <mem/pmm.h>
 #include <drivers/ahci.h>
 #include <ui/console.h>
 #include <string.h>
@@ -9,6 +10,17 @@
 
 static uint8_t swap_bitmap[SWAP_SIZE_PAGES / 8];
 static int swap_port = -1;
+static uint32_t run_hint = 0; // slot after the last batch, so batches stay adjacent
+static swap_stats_t stats;
+
+typedef struct {
+    uint32_t slot;
+    uint32_t phys; // 0 when the entry is free
+    uint32_t seq;  // insertion order: the lowest is the oldest
+} swap_cache_entry_t;
+
+static swap_cache_entry_t swap_cache[SWAP_CACHE_SIZE];
+static uint32_t cache_seq = 0;
 
 void swap_init(void) {
     for (int i = 0; i < 32; i++) {
@@ -24,6 +36,7 @@ void swap_init(void) {
     }
     
     memset(swap_bitmap, 0, sizeof(swap_bitmap));
+    memset(&stats, 0, sizeof(stats));
     console_write("Swap: Initialized on port ");
     console_write_dec(swap_port);
     console_write(" (16MB)\n");
@@ -50,12 +63,35 @@ static void mark_slot(int slot, int used) {
     }
 }
 
+static int slot_used(uint32_t slot) {
+    return swap_bitmap[slot / 8] & (1 << (slot % 8));
+}
+
+/* First run of count free slots at or after the hint, wrapping once. */
+static int find_free_run(uint32_t count) {
+    uint32_t run = 0;
+    for (uint32_t n = 0; n < SWAP_SIZE_PAGES + count; n++) {
+        uint32_t slot = (run_hint + n) % SWAP_SIZE_PAGES;
+        if (slot == 0) {
+            run = 0; // runs do not wrap around the end of the area
+        }
+        if (slot_used(slot)) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            return (int)(slot + 1 - count);
+        }
+    }
+    return -1;
+}
+
 int swap_out(void *buffer, uint32_t *swap_slot) {
     if (swap_port == -1) return -1;
     
     int slot = find_free_slot();
     if (slot == -1) {
-        console_write("Swap: No free slots!\n");
+        ++stats.full;
         return -1;
     }
     
@@ -67,9 +103,47 @@ int swap_out(void *buffer, uint32_t *swap_slot) {
     
     mark_slot(slot, 1);
     *swap_slot = (uint32_t)slot;
+    ++stats.pages_out;
+    ++stats.writes;
     return 0;
 }
 
+int swap_out_frames(const uint32_t *frames, uint32_t count, uint32_t *slots) {
+    if (swap_port == -1) return 0;
+    
+    uint32_t done = 0;
+    while (done < count) {
+        // Largest adjacent run still free, halving down to single slots
+        uint32_t len = count - done;
+        if (len > SWAP_BATCH_MAX) {
+            len = SWAP_BATCH_MAX;
+        }
+        int first = -1;
+        while (len > 0 && (first = find_free_run(len)) < 0) {
+            len /= 2;
+        }
+        if (first < 0) {
+            ++stats.full;
+            break;
+        }
+        
+        uint64_t lba = SWAP_START_LBA + (uint64_t)first * SECTORS_PER_PAGE;
+        if (ahci_write_frames(swap_port, lba, &frames[done], len) != 0) {
+            console_write("Swap: Write failed\n");
+            break;
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            mark_slot(first + (int)i, 1);
+            slots[done + i] = (uint32_t)first + i;
+        }
+        run_hint = ((uint32_t)first + len) % SWAP_SIZE_PAGES;
+        done += len;
+        stats.pages_out += len;
+        ++stats.writes;
+    }
+    return (int)done;
+}
+
 int swap_in(uint32_t swap_slot, void *buffer) {
     if (swap_port == -1) return -1;
     
@@ -81,11 +155,99 @@ int swap_in(uint32_t swap_slot, void *buffer) {
         return -1;
     }
     
+    ++stats.pages_in;
+    ++stats.reads;
     return 0;
 }
 
+int swap_in_frames(uint32_t first, const uint32_t *frames, uint32_t count) {
+    if (swap_port == -1 || first + count > SWAP_SIZE_PAGES) return -1;
+    
+    uint64_t lba = SWAP_START_LBA + (uint64_t)first * SECTORS_PER_PAGE;
+    if (ahci_read_frames(swap_port, lba, frames, count) != 0) {
+        return -1;
+    }
+    stats.pages_in += count;
+    ++stats.reads;
+    return 0;
+}
+
+static swap_cache_entry_t *cache_find(uint32_t swap_slot) {
+    for (uint32_t i = 0; i < SWAP_CACHE_SIZE; i++) {
+        if (swap_cache[i].phys && swap_cache[i].slot == swap_slot) {
+            return &swap_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void cache_drop(swap_cache_entry_t *entry) {
+    pmm_free_frame(entry->phys);
+    entry->phys = 0;
+    ++stats.ra_dropped;
+}
+
+void swap_cache_add(uint32_t swap_slot, uint32_t phys) {
+    // A free entry, or else the oldest one
+    swap_cache_entry_t *entry = &swap_cache[0];
+    for (uint32_t i = 0; i < SWAP_CACHE_SIZE && entry->phys; i++) {
+        if (!swap_cache[i].phys || swap_cache[i].seq - entry->seq > 0x80000000U) {
+            entry = &swap_cache[i];
+        }
+    }
+    if (entry->phys) {
+        cache_drop(entry);
+    }
+    entry->slot = swap_slot;
+    entry->phys = phys;
+    entry->seq = cache_seq++;
+    ++stats.ra_pages;
+}
+
+int swap_cache_lookup(uint32_t swap_slot) {
+    return cache_find(swap_slot) != NULL;
+}
+
+uint32_t swap_cache_take(uint32_t swap_slot) {
+    swap_cache_entry_t *entry = cache_find(swap_slot);
+    if (!entry) {
+        ++stats.ra_misses;
+        return 0;
+    }
+    uint32_t phys = entry->phys;
+    entry->phys = 0;
+    ++stats.ra_hits;
+    return phys;
+}
+
+uint32_t swap_cache_shrink(void) {
+    uint32_t freed = 0;
+    for (uint32_t i = 0; i < SWAP_CACHE_SIZE; i++) {
+        if (swap_cache[i].phys) {
+            cache_drop(&swap_cache[i]);
+            freed++;
+        }
+    }
+    return freed;
+}
+
 void swap_free(uint32_t swap_slot) {
     if (swap_slot < SWAP_SIZE_PAGES) {
+        swap_cache_entry_t *entry = cache_find(swap_slot);
+        if (entry) {
+            cache_drop(entry);
+        }
         mark_slot(swap_slot, 0);
     }
 }
+
+void swap_get_stats(swap_stats_t *out) {
+    *out = stats;
+    out->slots_used = 0;
+    for (uint32_t i = 0; i < SWAP_SIZE_PAGES; i++) {
+        if (slot_used(i)) {
+            out->slots_used++;
+        }
+    }
+    out->slots_total = SWAP_SIZE_PAGES;
+}
@@ -0,0 +1,395 @@
+#include "mem/vma.h"
+#include "mem/heap.h"
+#include "mem/pmm.h"
+#include "mem/paging.h"
+#include "mem/shm.h"
+#include <string.h>
+
+#define VMA_INITIAL_CAPACITY 8U
+
+static vm_space_t *current_space = NULL;
+static int fault_around_enabled = 1;
+
+static inline uint32_t page_round_up(uint32_t value)
+{
+    return (value + PAGE_SIZE - 1U) & ~(PAGE_SIZE - 1U);
+}
+
+/* Each VMA_SHM area holds one reference on its region. */
+static void area_get(const vma_t *vma)
+{
+    if (vma->kind == VMA_SHM) {
+        shm_region_get(vma->object);
+    }
+}
+
+static void area_put(const vma_t *vma)
+{
+    if (vma->kind == VMA_SHM) {
+        shm_region_put(vma->object);
+    }
+}
+
+vm_space_t *vma_space_create(void)
+{
+    vm_space_t *space = (vm_space_t *)kmalloc(sizeof(vm_space_t));
+    if (!space) {
+        return NULL;
+    }
+    space->areas = (vma_t *)kmalloc(VMA_INITIAL_CAPACITY * sizeof(vma_t));
+    if (!space->areas) {
+        kfree(space);
+        return NULL;
+    }
+    space->count = 0;
+    space->capacity = VMA_INITIAL_CAPACITY;
+    space->cache = 0;
+    space->window = FAULT_AROUND_MIN;
+    space->window_start = space->window_end = 0;
+    memset(&space->stats, 0, sizeof(space->stats));
+    return space;
+}
+
+vm_space_t *vma_space_clone(const vm_space_t *src)
+{
+    vm_space_t *space = (vm_space_t *)kmalloc(sizeof(vm_space_t));
+    if (!space) {
+        return NULL;
+    }
+    space->areas = (vma_t *)kmalloc(src->capacity * sizeof(vma_t));
+    if (!space->areas) {
+        kfree(space);
+        return NULL;
+    }
+    memcpy(space->areas, src->areas, src->count * sizeof(vma_t));
+    for (uint32_t i = 0; i < src->count; ++i) {
+        area_get(&space->areas[i]);
+    }
+    space->count = src->count;
+    space->capacity = src->capacity;
+    space->cache = 0;
+    space->window = FAULT_AROUND_MIN;
+    space->window_start = space->window_end = 0;
+    memset(&space->stats, 0, sizeof(space->stats));
+    return space;
+}
+
+void vma_space_destroy(vm_space_t *space)
+{
+    if (!space) {
+        return;
+    }
+    if (space == current_space) {
+        current_space = NULL;
+    }
+    for (uint32_t i = 0; i < space->count; ++i) {
+        area_put(&space->areas[i]);
+    }
+    kfree(space->areas);
+    kfree(space);
+}
+
+void vma_space_activate(vm_space_t *space)
+{
+    current_space = space;
+}
+
+vm_space_t *vma_current_space(void)
+{
+    return current_space;
+}
+
+/* Index of the first area ending above addr (count if none). */
+static uint32_t lower_bound(const vm_space_t *space, uint32_t addr)
+{
+    uint32_t lo = 0;
+    uint32_t hi = space->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2U;
+        if (space->areas[mid].end <= addr) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const vma_t *vma_find(vm_space_t *space, uint32_t addr)
+{
+    if (!space || !space->count) {
+        return NULL;
+    }
+    if (space->cache < space->count) {
+        const vma_t *hit = &space->areas[space->cache];
+        if (addr >= hit->start && addr < hit->end) {
+            return hit;
+        }
+    }
+    uint32_t i = lower_bound(space, addr);
+    if (i == space->count || addr < space->areas[i].start) {
+        return NULL;
+    }
+    space->cache = i;
+    return &space->areas[i];
+}
+
+/* Makes room for one more area at index i. */
+static int open_slot(vm_space_t *space, uint32_t i)
+{
+    if (space->count == space->capacity) {
+        uint32_t capacity = space->capacity * 2U;
+        vma_t *areas = (vma_t *)kmalloc(capacity * sizeof(vma_t));
+        if (!areas) {
+            return -1;
+        }
+        memcpy(areas, space->areas, space->count * sizeof(vma_t));
+        kfree(space->areas);
+        space->areas = areas;
+        space->capacity = capacity;
+    }
+    memmove(&space->areas[i + 1U], &space->areas[i], (space->count - i) * sizeof(vma_t));
+    ++space->count;
+    return 0;
+}
+
+static void close_slot(vm_space_t *space, uint32_t i)
+{
+    memmove(&space->areas[i], &space->areas[i + 1U], (space->count - i - 1U) * sizeof(vma_t));
+    --space->count;
+}
+
+static int range_ok(uint32_t start, uint32_t size)
+{
+    return size && !(start & (PAGE_SIZE - 1U)) && !(size & (PAGE_SIZE - 1U)) &&
+           start >= VMA_USER_START && start < VMA_USER_END && size <= VMA_USER_END - start;
+}
+
+int vma_insert(vm_space_t *space, uint32_t start, uint32_t size, uint32_t prot,
+               uint32_t kind, uint32_t object)
+{
+    if (!range_ok(start, size)) {
+        return -1;
+    }
+    uint32_t i = lower_bound(space, start);
+    if (i < space->count && space->areas[i].start < start + size) {
+        return -1;
+    }
+    if (open_slot(space, i) != 0) {
+        return -1;
+    }
+    vma_t *vma = &space->areas[i];
+    vma->start = start;
+    vma->end = start + size;
+    vma->prot = prot;
+    vma->kind = kind;
+    vma->object = object;
+    area_get(vma);
+    space->cache = i;
+    return 0;
+}
+
+uint32_t vma_find_free(vm_space_t *space, uint32_t size)
+{
+    size = page_round_up(size);
+    if (!size || size > VMA_MMAP_TOP - VMA_USER_START) {
+        return 0;
+    }
+    /* Walk the gaps from the top down. */
+    uint32_t top = VMA_MMAP_TOP;
+    for (uint32_t i = lower_bound(space, top - 1U); ; --i) {
+        uint32_t floor = VMA_USER_START;
+        if (i > 0 && space->areas[i - 1U].end > floor) {
+            floor = space->areas[i - 1U].end;
+        }
+        if (i < space->count && space->areas[i].start < top) {
+            top = space->areas[i].start;
+        }
+        if (top >= floor && top - floor >= size) {
+            return top - size;
+        }
+        if (i == 0) {
+            return 0;
+        }
+        top = space->areas[i - 1U].start;
+    }
+}
+
+int vma_remove(vm_space_t *space, uint32_t start, uint32_t size)
+{
+    if (!range_ok(start, size)) {
+        return -1;
+    }
+    uint32_t end = start + size;
+    uint32_t i = lower_bound(space, start);
+    while (i < space->count && space->areas[i].start < end) {
+        vma_t *vma = &space->areas[i];
+        if (vma->start < start && vma->end > end) {
+            /* Punch a hole: the area splits in two. */
+            if (open_slot(space, i + 1U) != 0) {
+                return -1;
+            }
+            vma = &space->areas[i];
+            space->areas[i + 1U] = *vma;
+            space->areas[i + 1U].start = end;
+            vma->end = start;
+            area_get(vma);
+            break;
+        }
+        if (vma->start < start) {
+            vma->end = start;
+            ++i;
+        } else if (vma->end > end) {
+            vma->start = end;
+            break;
+        } else {
+            area_put(vma);
+            close_slot(space, i);
+        }
+    }
+    space->cache = 0;
+    return 0;
+}
+
+/* Splits the area at index i so that one starts exactly at addr. */
+static int split_at(vm_space_t *space, uint32_t i, uint32_t addr)
+{
+    vma_t *vma = &space->areas[i];
+    if (addr <= vma->start || addr >= vma->end) {
+        return 0;
+    }
+    if (open_slot(space, i + 1U) != 0) {
+        return -1;
+    }
+    vma = &space->areas[i];
+    space->areas[i + 1U] = *vma;
+    space->areas[i + 1U].start = addr;
+    vma->end = addr;
+    area_get(vma);
+    return 0;
+}
+
+int vma_protect(vm_space_t *space, uint32_t start, uint32_t size, uint32_t prot)
+{
+    if (!range_ok(start, size)) {
+        return -1;
+    }
+    uint32_t end = start + size;
+    uint32_t first = lower_bound(space, start);
+    /* The range must be covered without gaps. */
+    uint32_t covered = start;
+    for (uint32_t i = first; i < space->count && covered < end; ++i) {
+        if (space->areas[i].start > covered) {
+            return -1;
+        }
+        covered = space->areas[i].end;
+    }
+    if (covered < end) {
+        return -1;
+    }
+
+    if (split_at(space, first, start) != 0) {
+        return -1;
+    }
+    if (space->areas[first].start < start) {
+        ++first;
+    }
+    uint32_t i = first;
+    for (; i < space->count && space->areas[i].start < end; ++i) {
+        if (space->areas[i].end > end && split_at(space, i, end) != 0) {
+            return -1;
+        }
+        space->areas[i].prot = prot;
+    }
+    space->cache = first;
+    return 0;
+}
+
+uint32_t vma_page_flags(uint32_t prot)
+{
+    if (prot & VMA_WRITE) {
+        return PAGE_PRESENT | PAGE_USER | PAGE_RW;
+    }
+    if (prot & (VMA_READ | VMA_EXEC)) {
+        return PAGE_PRESENT | PAGE_USER;
+    }
+    return PAGE_PRESENT; // supervisor-only: every user access faults
+}
+
+void vma_fault_window(vm_space_t *space, const vma_t *vma, uint32_t addr,
+                      uint32_t *start, uint32_t *pages)
+{
+    uint32_t page = addr & ~(PAGE_SIZE - 1U);
+    *start = page;
+    *pages = 1;
+    if (!fault_around_enabled || (vma->kind != VMA_ANON && vma->kind != VMA_STACK)) {
+        return;
+    }
+
+    /*
+     * A fault right past either edge of the previous window means the
+     * program is streaming (upwards through an array, downwards through the
+     * stack), so the window doubles. Anything else falls back to one page.
+     */
+    if (page == space->window_end || page + PAGE_SIZE == space->window_start) {
+        if (space->window < FAULT_AROUND_MAX) {
+            space->window *= 2U;
+        }
+    } else {
+        space->window = FAULT_AROUND_MIN;
+    }
+
+    uint32_t size = space->window * PAGE_SIZE;
+    uint32_t first = page & ~(size - 1U);
+    uint32_t last = first + size;
+    if (first < vma->start) {
+        first = vma->start;
+    }
+    if (last > vma->end) {
+        last = vma->end;
+    }
+    space->window_start = first;
+    space->window_end = last;
+    *start = first;
+    *pages = (last - first) / PAGE_SIZE;
+}
+
+int vma_set_fault_around(int enable)
+{
+    int old = fault_around_enabled;
+    fault_around_enabled = enable;
+    return old;
+}
+
+uint32_t vma_setup_stack(vm_space_t *space)
+{
+    if (vma_insert(space, USER_STACK_TOP - USER_STACK_RESERVE, USER_STACK_RESERVE,
+                   VMA_READ | VMA_WRITE, VMA_STACK, 0) != 0) {
+        return 0;
+    }
+    uint32_t frames[USER_STACK_PAGES];
+    for (uint32_t i = 0; i < USER_STACK_PAGES; ++i) {
+        frames[i] = pmm_alloc_zeroed_frame();
+        if (!frames[i]) {
+            while (i-- > 0) {
+                pmm_free_frame(frames[i]);
+            }
+            vma_remove(space, USER_STACK_TOP - USER_STACK_RESERVE, USER_STACK_RESERVE);
+            return 0;
+        }
+    }
+    paging_map_frames(USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE, frames, USER_STACK_PAGES,
+                      PAGE_PRESENT | PAGE_RW | PAGE_USER);
+    return USER_STACK_TOP;
+}
+
+void vma_space_clear(vm_space_t *space)
+{
+    for (uint32_t i = 0; i < space->count; ++i) {
+        vma_t *vma = &space->areas[i];
+        paging_unmap_range(vma->start, (vma->end - vma->start) / PAGE_SIZE, 1);
+        area_put(vma);
+    }
+    space->count = 0;
+    space->cache = 0;
+}
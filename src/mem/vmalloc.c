@@ -0,0 +1,163 @@
+#include "mem/vmalloc.h"
+#include "mem/heap.h"
+#include "mem/pmm.h"
+#include "mem/paging.h"
+#include "ui/console.h"
+#include "arch/x86/cpu.h"
+
+#define VMALLOC_MAP_CHUNK 32U /* frames gathered per paging_map_frames call */
+
+/*
+ * Areas are kept in a list sorted by address; a new area takes the first
+ * gap that fits (first fit). The descriptors themselves are small kmallocs,
+ * so they come from the slab caches and never recurse back in here.
+ */
+typedef struct vm_area {
+    struct vm_area *next;
+    uint32_t addr;
+    uint32_t pages;  /* mapped pages, not counting the guard page */
+} vm_area_t;
+
+static vm_area_t *areas = NULL;
+static uint32_t area_count = 0;
+static uint32_t mapped_pages = 0;
+
+static void area_unmap(uint32_t addr, uint32_t pages)
+{
+    paging_unmap_range(addr, pages, 1);
+}
+
+/* Reserves pages + 1 (guard) pages of address space and links vm in. */
+static int area_reserve(vm_area_t *vm, uint32_t pages)
+{
+    uint32_t span = (pages + 1U) * PAGE_SIZE;
+    uint32_t addr = VMALLOC_START;
+    vm_area_t **link = &areas;
+    while (*link) {
+        vm_area_t *cur = *link;
+        if (cur->addr - addr >= span) {
+            break;
+        }
+        addr = cur->addr + (cur->pages + 1U) * PAGE_SIZE;
+        link = &cur->next;
+    }
+    if (VMALLOC_END - addr < span) {
+        return -1;
+    }
+    vm->addr = addr;
+    vm->pages = pages;
+    vm->next = *link;
+    *link = vm;
+    ++area_count;
+    return 0;
+}
+
+static vm_area_t *area_unlink(uint32_t addr)
+{
+    for (vm_area_t **link = &areas; *link; link = &(*link)->next) {
+        vm_area_t *vm = *link;
+        if (vm->addr == addr) {
+            *link = vm->next;
+            --area_count;
+            return vm;
+        }
+        if (vm->addr > addr) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+void vmalloc_init(void)
+{
+    /* Every directory created from now on shares these tables. */
+    paging_reserve_kernel_tables(VMALLOC_START, VMALLOC_SIZE);
+    console_write("vmalloc: ");
+    console_write_dec(VMALLOC_SIZE / (1024 * 1024));
+    console_write(" MiB at ");
+    console_write_hex(VMALLOC_START);
+    console_write("\n");
+}
+
+void *vmalloc(size_t size)
+{
+    if (size == 0 || size > VMALLOC_SIZE - PAGE_SIZE) {
+        return NULL;
+    }
+    uint32_t pages = ((uint32_t)size + PAGE_SIZE - 1U) / PAGE_SIZE;
+    vm_area_t *vm = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+    if (!vm) {
+        return NULL;
+    }
+
+    uint32_t irq = cpu_save_irq();
+    int reserved = area_reserve(vm, pages);
+    cpu_restore_irq(irq);
+    if (reserved != 0) {
+        kfree(vm);
+        return NULL;
+    }
+
+    uint32_t frames[VMALLOC_MAP_CHUNK];
+    for (uint32_t i = 0; i < pages; ) {
+        uint32_t count = 0;
+        while (count < VMALLOC_MAP_CHUNK && i + count < pages) {
+            frames[count] = pmm_alloc_frame();
+            if (!frames[count]) {
+                while (count-- > 0) {
+                    pmm_free_frame(frames[count]);
+                }
+                area_unmap(vm->addr, i);
+                irq = cpu_save_irq();
+                area_unlink(vm->addr);
+                cpu_restore_irq(irq);
+                kfree(vm);
+                return NULL;
+            }
+            ++count;
+        }
+        paging_map_frames(vm->addr + i * PAGE_SIZE, frames, count, PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL);
+        i += count;
+    }
+    irq = cpu_save_irq();
+    mapped_pages += pages;
+    cpu_restore_irq(irq);
+    return (void *)vm->addr;
+}
+
+void vfree(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    uint32_t irq = cpu_save_irq();
+    vm_area_t *vm = area_unlink((uint32_t)ptr);
+    if (vm) {
+        mapped_pages -= vm->pages;
+    }
+    cpu_restore_irq(irq);
+    if (!vm) {
+        console_write("vfree: no area at ");
+        console_write_hex((uint32_t)ptr);
+        console_write("\n");
+        return;
+    }
+    area_unmap(vm->addr, vm->pages);
+    kfree(vm);
+}
+
+int is_vmalloc_addr(const void *ptr)
+{
+    uint32_t addr = (uint32_t)ptr;
+    return addr >= VMALLOC_START && addr < VMALLOC_END;
+}
+
+size_t vmalloc_bytes_in_use(void)
+{
+    return (size_t)mapped_pages * PAGE_SIZE;
+}
+
+uint32_t vmalloc_area_count(void)
+{
+    return area_count;
+}
@@ -3,7 +3,9 @@
 #include <mem/heap.h>
 #include <mem/paging.h>
 #include <mem/pmm.h>
+#include <mem/vma.h>
 #include <fs/elf.h>
+#include <arch/x86/cpu.h>
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -26,6 +28,8 @@ typedef struct task_entry {
     uint8_t *stack;
     uint32_t kernel_stack; // ESP0 for TSS
     uint32_t page_directory_phys; // Physical address of page directory
+    vm_space_t *vm; // User areas; NULL for kernel tasks
+    uint8_t wake_pending; // woken while not asleep: the next sched_sleep returns at once
 } task_entry_t;
 
 static task_entry_t tasks[MAX_TASKS];
@@ -138,7 +142,7 @@ int32_t sched_spawn_user(void (*entry)(void), const char *name)
     }
     
     // 4. Temporarily switch to new page directory to map user memory
-    uint32_t old_pd = paging_get_kernel_directory();
+    uint32_t old_pd = paging_get_current_directory();
     paging_switch_directory(new_pd_phys);
     
     // Remap user stack pages as User-accessible (Ring 3)
@@ -212,33 +216,37 @@ int32_t sched_spawn_elf(const char *path)
     }
     uint32_t kstack_top = ((uint32_t)kstack + STACK_SIZE) & ~0xF;
 
-    // 3. Switch to new PD to load ELF
-    uint32_t old_pd = paging_get_kernel_directory();
+    vm_space_t *space = vma_space_create();
+    if (!space) {
+        kfree(kstack);
+        paging_destroy_directory(new_pd_phys);
+        return -1;
+    }
+
+    // 3. Switch to new PD to load ELF; the loader records its segments in
+    // the active space
+    uint32_t old_pd = paging_get_current_directory();
     paging_switch_directory(new_pd_phys);
+    vma_space_activate(space);
     
     // 4. Load ELF
     uint32_t entry_point = 0;
     uint32_t result = elf_load(path, &entry_point);
     
-    if (result == 0) {
+    // 5. Allocate User Stack below the kernel half
+    uint32_t ustack_top = result ? vma_setup_stack(space) : 0;
+    
+    // Switch back
+    paging_switch_directory(old_pd);
+    vma_space_activate(current_task ? current_task->vm : NULL);
+
+    if (!ustack_top) {
         // Failed to load
-        paging_switch_directory(old_pd);
+        vma_space_destroy(space);
         kfree(kstack);
         paging_destroy_directory(new_pd_phys);
         return -1;
     }
-    
-    // 5. Allocate User Stack
-    // Map 16KB of stack at 0xBFFFF000
-    uint32_t ustack_top = 0xC0000000 - 0x1000;
-    for (int i = 0; i < 4; i++) {
-        uint32_t page_vaddr = ustack_top - (i * 0x1000);
-        uint32_t phys = pmm_alloc_frame();
-        paging_map(page_vaddr, phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
-    }
-    
-    // Switch back
-    paging_switch_directory(old_pd);
 
     // 6. Setup Task
     task_entry_t *task = &tasks[slot];
@@ -250,6 +258,7 @@ int32_t sched_spawn_elf(const char *path)
     task->stack = kstack;
     task->kernel_stack = kstack_top;
     task->page_directory_phys = new_pd_phys;
+    task->vm = space;
 
     // 7. Setup Interrupt Frame
     interrupt_frame_t *frame = (interrupt_frame_t *)(kstack_top - sizeof(interrupt_frame_t));
@@ -259,7 +268,7 @@ int32_t sched_spawn_elf(const char *path)
     frame->edi = 0;
     frame->esi = 0;
     frame->ebp = 0;
-    frame->user_esp = ustack_top + 0x1000 - 16; // Top of stack
+    frame->user_esp = ustack_top - 16; // Top of stack
     frame->ebx = 0;
     frame->edx = 0;
     frame->ecx = 0;
@@ -277,6 +286,68 @@ int32_t sched_spawn_elf(const char *path)
     return (int32_t)task->id;
 }
 
+/*
+ * Duplicates the calling user process. The child shares the parent's pages
+ * copy-on-write and resumes from the same syscall frame with eax = 0.
+ */
+int32_t sched_fork(interrupt_frame_t *frame)
+{
+    if (!current_task || !current_task->page_directory_phys ||
+        current_task->page_directory_phys == paging_get_kernel_directory()) {
+        return -1; // kernel tasks have no user address space to clone
+    }
+    int slot = find_free_slot();
+    if (slot < 0) return -1;
+
+    uint8_t *kstack = (uint8_t *)kmalloc(STACK_SIZE);
+    if (!kstack) return -1;
+    uint32_t kstack_top = ((uint32_t)kstack + STACK_SIZE) & ~0xF;
+
+    vm_space_t *space = NULL;
+    if (current_task->vm) {
+        space = vma_space_clone(current_task->vm);
+        if (!space) {
+            kfree(kstack);
+            return -1;
+        }
+    }
+
+    uint32_t new_pd_phys = paging_clone_directory(current_task->page_directory_phys,
+                                                  current_task->vm);
+    if (!new_pd_phys) {
+        vma_space_destroy(space);
+        kfree(kstack);
+        return -1;
+    }
+
+    task_entry_t *task = &tasks[slot];
+    memset(task, 0, sizeof(*task));
+    task->id = next_task_id++;
+    task->state = TASK_READY;
+    task->entry = current_task->entry;
+    strncpy(task->name, current_task->name, sizeof(task->name) - 1);
+    task->stack = kstack;
+    task->kernel_stack = kstack_top;
+    task->page_directory_phys = new_pd_phys;
+    task->vm = space;
+
+    interrupt_frame_t *child = (interrupt_frame_t *)(kstack_top - sizeof(interrupt_frame_t));
+    memcpy(child, frame, sizeof(*child));
+    child->eax = 0;
+    task->frame = child;
+
+    active_tasks++;
+    return (int32_t)task->id;
+}
+
+int32_t sched_spawn_kernel(void (*entry)(void), const char *name)
+{
+    if (!entry || !name) {
+        return -1;
+    }
+    return spawn_task(entry, name);
+}
+
 int32_t sched_spawn_named(const char *name)
 {
     if (!name) {
@@ -338,6 +409,43 @@ void sched_yield(void)
     __asm__ volatile ("hlt");
 }
 
+void sched_sleep(void)
+{
+    if (!current_task || current_task->id == 0) {
+        return; // the shell task never blocks
+    }
+    __asm__ volatile ("cli");
+    if (current_task->wake_pending) {
+        // Woken between the caller's last check and the cli
+        current_task->wake_pending = 0;
+        __asm__ volatile ("sti");
+        return;
+    }
+    if (current_task->state == TASK_RUNNING) {
+        current_task->state = TASK_SLEEPING;
+    }
+    // The next tick switches away; a wake makes us READY again
+    while (current_task->state == TASK_SLEEPING) {
+        __asm__ volatile ("sti; hlt; cli");
+    }
+    __asm__ volatile ("sti");
+}
+
+int sched_wake(uint32_t id)
+{
+    uint32_t irq = cpu_save_irq();
+    task_entry_t *task = find_task_by_id(id);
+    int woken = 0;
+    if (task && task->state == TASK_SLEEPING) {
+        task->state = TASK_READY;
+        woken = 1;
+    } else if (task) {
+        task->wake_pending = 1; // not asleep yet: don't lose it
+    }
+    cpu_restore_irq(irq);
+    return woken;
+}
+
 uint32_t sched_get_current_pid(void)
 {
     if (current_task) {
@@ -346,6 +454,28 @@ uint32_t sched_get_current_pid(void)
     return 0;
 }
 
+void sched_set_current_vm(vm_space_t *space)
+{
+    if (current_task) {
+        current_task->vm = space;
+    }
+    vma_space_activate(space);
+}
+
+int sched_exit_current(interrupt_frame_t *frame)
+{
+    if (!current_task || current_task->id == 0) {
+        return -1;
+    }
+    sched_kill(current_task->id);
+    interrupt_frame_t *next = sched_tick(frame);
+    if (next == frame) {
+        return -1;
+    }
+    interrupt_request_frame_switch(next);
+    return 0;
+}
+
 /*
  * Main scheduler entry point called from the timer interrupt.
  * It returns the interrupt_frame_t* that the CPU should resume with.
@@ -372,6 +502,8 @@ interrupt_frame_t *sched_tick(interrupt_frame_t *frame)
     if (current_task->state == TASK_RUNNING) {
         current_task->frame = frame;
         current_task->state = TASK_READY;
+    } else if (current_task->state == TASK_SLEEPING) {
+        current_task->frame = frame; // resumes here once woken
     }
 
     if (current_task->state == TASK_ZOMBIE) {
@@ -387,12 +519,13 @@ interrupt_frame_t *sched_tick(interrupt_frame_t *frame)
         if (!current_task) {
             current_task = &tasks[0];
         }
-        if (current_task->state != TASK_RUNNING) {
+        if (current_task->state != TASK_RUNNING && current_task->state != TASK_SLEEPING) {
             current_task->state = TASK_RUNNING;
         }
         if (!current_task->frame) {
             current_task->frame = frame;
         }
+        vma_space_activate(current_task->vm);
         return frame;
     }
 
@@ -406,6 +539,7 @@ interrupt_frame_t *sched_tick(interrupt_frame_t *frame)
     if (current_task->page_directory_phys) {
         paging_switch_directory(current_task->page_directory_phys);
     }
+    vma_space_activate(current_task->vm);
 
     if (!current_task->frame) {
         current_task->frame = frame;
@@ -434,6 +568,8 @@ void sched_for_each(sched_iter_cb cb)
         info.state = tasks[i].state;
         memset(info.name, 0, sizeof(info.name));
         strncpy(info.name, tasks[i].name, sizeof(info.name) - 1);
+        info.faults = tasks[i].vm ? tasks[i].vm->stats.faults : 0;
+        info.prefaulted = tasks[i].vm ? tasks[i].vm->stats.prefaulted : 0;
         cb(&info);
     }
 }
@@ -486,6 +622,8 @@ static void destroy_task(task_entry_t *task)
         paging_destroy_directory(task->page_directory_phys);
         task->page_directory_phys = 0;
     }
+    vma_space_destroy(task->vm);
+    task->vm = NULL;
     memset(task->name, 0, sizeof(task->name));
     task->state = TASK_UNUSED;
     task->entry = NULL;
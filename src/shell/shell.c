@@ -6,6 +6,13 @@
 #include "mem/paging.h"
 #include "mem/heap.h"
 #include "apps/sysinfo.h"
+#include "apps/pmmbench.h"
+#include "apps/forkbench.h"
+#include "apps/tlbbench.h"
+#include "apps/ctxbench.h"
+#include "apps/faultbench.h"
+#include "apps/slabinfo.h"
+#include "apps/heapstat.h"
 #include "sched/sched.h"
 #include "sys/power.h"
 #include <string.h>
@@ -94,7 +101,7 @@ static void redraw_prompt_with_buffer(const char *buffer) {
 static int complete_command(char *buffer, int current_len) {
     const char *commands[] = {
         "help", "clear", "echo", "ticks", "sysinfo", "ps", "spawn", "kill",
-        "halt", "shutdown", "pwd", "cd", "ls", "cat", NULL
+        "halt", "shutdown", "pwd", "cd", "ls", "cat", "pmmbench", "forkbench", "tlbbench", "ctxbench", "faultbench", "slabinfo", "heapstat", NULL
     };
     
     char matches[16][32];
@@ -225,9 +232,12 @@ static int getline_block(char *buffer, int max)
         int c;
         while ((c = keyboard_read_char()) == -1)
         {
-            /* busy-wait for keypress */
+            /* busy-wait for keypress; spare cycles pre-zero frames */
             virtio_input_poll();
-            __asm__ volatile("hlt");
+            if (pmm_zero_pool_refill(8) == 0)
+            {
+                __asm__ volatile("hlt");
+            }
         }
         char ch = (char)c;
         if (ch == '\r' || ch == '\n')
@@ -322,6 +332,13 @@ static void cmd_help(void)
     console_write("  satastatus        Show SATA port status\n");
     console_write("  satarescan        Rescan SATA ports\n");
     console_write("  swaptest          Test swap space functionality\n");
+    console_write("  pmmbench          Measure frame alloc/free cost at 10/50/99% use\n");
+    console_write("  forkbench         Measure copy-on-write clone cost against resident size\n");
+    console_write("  tlbbench          Compare kernel memory walks over 4 MiB and 4 KiB pages\n");
+    console_write("  ctxbench          Measure address-space switches with and without global pages\n");
+    console_write("  faultbench        Count demand faults on a streamed area with and without fault-around\n");
+    console_write("  slabinfo          Show slab cache statistics\n");
+    console_write("  heapstat [dump]   Show heap call sites; dump live allocations to virtio console\n");
     console_putc('\n');
 }
 
@@ -338,6 +355,20 @@ static void cmd_ticks(void)
     console_putc('\n');
 }
 
+static void write_dec_padded(uint32_t value, uint32_t width)
+{
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10)
+    {
+        ++digits;
+    }
+    console_write_dec(value);
+    while (digits++ < width)
+    {
+        console_putc(' ');
+    }
+}
+
 static void ps_callback(const sched_task_info_t *info)
 {
     console_write_dec(info->id);
@@ -359,13 +390,15 @@ static void ps_callback(const sched_task_info_t *info)
     {
         console_putc(' ');
     }
+    write_dec_padded(info->faults, 8);
+    write_dec_padded(info->prefaulted, 9);
     console_write(info->name);
     console_putc('\n');
 }
 
 static void cmd_ps(void)
 {
-    console_write("PID  STATE    NAME\n");
+    console_write("PID STATE   FAULTS  AHEAD    NAME\n");
     sched_for_each(ps_callback);
 }
 
@@ -946,6 +979,38 @@ void shell_run(void)
         {
             cmd_swaptest();
         }
+        else if (!strcmp(input, "pmmbench"))
+        {
+            app_pmmbench();
+        }
+        else if (!strcmp(input, "forkbench"))
+        {
+            app_forkbench();
+        }
+        else if (!strcmp(input, "tlbbench"))
+        {
+            app_tlbbench();
+        }
+        else if (!strcmp(input, "ctxbench"))
+        {
+            app_ctxbench();
+        }
+        else if (!strcmp(input, "faultbench"))
+        {
+            app_faultbench();
+        }
+        else if (!strcmp(input, "slabinfo"))
+        {
+            app_slabinfo();
+        }
+        else if (!strcmp(input, "heapstat"))
+        {
+            app_heapstat(NULL);
+        }
+        else if (!strncmp(input, "heapstat ", 9))
+        {
+            app_heapstat(input + 9);
+        }
         else if (!strcmp(input, "usermode"))
         {
             cmd_usermode();
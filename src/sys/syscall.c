@@ -8,6 +8,7 @@
 #include "fs/elf.h"
 #include "mem/pmm.h"
 #include "mem/paging.h"
+#include "mem/vma.h"
 
 typedef int32_t (*syscall_fn)(interrupt_frame_t *frame);
 
@@ -73,10 +74,38 @@ static int32_t sys_getpid(interrupt_frame_t *frame)
     return (int32_t)sched_get_current_pid();
 }
 
+#define EXEC_PATH_MAX 256U
+
+/*
+ * Copies a NUL-terminated user string into dst (size bytes). With an
+ * address space, every page it touches must lie in an area a user read
+ * may touch, so a bad pointer fails here instead of faulting. Returns -1
+ * if the string is unmapped or does not fit.
+ */
+static int copy_user_string(char *dst, const char *src, uint32_t size)
+{
+    vm_space_t *space = vma_current_space();
+    for (uint32_t i = 0; i < size; ++i) {
+        uint32_t addr = (uint32_t)src + i;
+        if (space && (i == 0 || !(addr & (PAGE_SIZE - 1U)))) {
+            const vma_t *vma = vma_find(space, addr);
+            if (!vma || !vma->prot) {
+                return -1;
+            }
+        }
+        dst[i] = src[i];
+        if (!dst[i]) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
 static int32_t sys_exec(interrupt_frame_t *frame)
 {
-    const char *path = (const char *)frame->ebx;
-    if (!path) {
+    // The path lives in the image exec is about to tear down
+    char path[EXEC_PATH_MAX];
+    if (!frame->ebx || copy_user_string(path, (const char *)frame->ebx, sizeof(path)) != 0) {
         return -1;
     }
     
@@ -84,6 +113,20 @@ static int32_t sys_exec(interrupt_frame_t *frame)
     console_write(path);
     console_write("\n");
     
+    // The old image goes away first so the new segments do not collide
+    // with its areas. Past this point a failure leaves nothing to return
+    // to; the process faults on its next instruction and is killed.
+    vm_space_t *space = vma_current_space();
+    if (space) {
+        vma_space_clear(space);
+    } else {
+        space = vma_space_create();
+        if (!space) {
+            return -1;
+        }
+        sched_set_current_vm(space);
+    }
+
     uint32_t entry_point = 0;
     uint32_t result = elf_load(path, &entry_point);
     
@@ -92,24 +135,16 @@ static int32_t sys_exec(interrupt_frame_t *frame)
         return -1;
     }
 
-    // Setup User Stack
-    // Map 16KB of stack at the top of user space (0xBFFFF000)
-    // We use 0xC0000000 (KERNEL_VIRT_BASE) as the limit
-    uint32_t stack_top = 0xC0000000 - 0x1000; 
-    
-    for (int i = 0; i < 4; i++) {
-        uint32_t page_vaddr = stack_top - (i * 0x1000);
-        uint32_t phys = pmm_alloc_frame();
-        if (!phys) {
-            console_write("[exec] Failed to allocate stack\n");
-            return -1;
-        }
-        paging_map(page_vaddr, phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+    // Setup User Stack below the kernel half; only its top pages are mapped
+    uint32_t stack_top = vma_setup_stack(space);
+    if (!stack_top) {
+        console_write("[exec] Failed to allocate stack\n");
+        return -1;
     }
 
     // Update Interrupt Frame to jump to new entry point
     frame->eip = entry_point;
-    frame->user_esp = stack_top + 0x1000 - 16; // Small padding at top
+    frame->user_esp = stack_top - 16; // Small padding at top
     
     // Reset registers
     frame->eax = 0;
@@ -127,6 +162,73 @@ static int32_t sys_exec(interrupt_frame_t *frame)
     return 0;
 }
 
+static int32_t sys_fork(interrupt_frame_t *frame)
+{
+    return sched_fork(frame);
+}
+
+static inline uint32_t page_round_up(uint32_t value)
+{
+    return (value + PAGE_SIZE - 1U) & ~(PAGE_SIZE - 1U);
+}
+
+// Only records the area; its pages are filled by demand faults.
+static int32_t sys_mmap(interrupt_frame_t *frame)
+{
+    vm_space_t *space = vma_current_space();
+    uint32_t addr = frame->ebx;
+    uint32_t size = page_round_up(frame->ecx);
+    uint32_t prot = frame->edx & (PROT_READ | PROT_WRITE | PROT_EXEC);
+    uint32_t flags = frame->esi;
+    if (!space || !size || size < frame->ecx) {
+        return -1;
+    }
+
+    if (flags & MAP_FIXED) {
+        // Replaces whatever was mapped there
+        if (vma_remove(space, addr, size) != 0) {
+            return -1;
+        }
+        paging_unmap_range(addr, size / PAGE_SIZE, 1);
+    } else if (addr && vma_insert(space, addr, size, prot, VMA_ANON, 0) == 0) {
+        return (int32_t)addr; // the hint was free
+    } else {
+        addr = vma_find_free(space, size);
+        if (!addr) {
+            return -1;
+        }
+    }
+    if (vma_insert(space, addr, size, prot, VMA_ANON, 0) != 0) {
+        return -1;
+    }
+    return (int32_t)addr;
+}
+
+static int32_t sys_munmap(interrupt_frame_t *frame)
+{
+    vm_space_t *space = vma_current_space();
+    uint32_t addr = frame->ebx;
+    uint32_t size = page_round_up(frame->ecx);
+    if (!space || vma_remove(space, addr, size) != 0) {
+        return -1;
+    }
+    paging_unmap_range(addr, size / PAGE_SIZE, 1);
+    return 0;
+}
+
+static int32_t sys_mprotect(interrupt_frame_t *frame)
+{
+    vm_space_t *space = vma_current_space();
+    uint32_t addr = frame->ebx;
+    uint32_t size = page_round_up(frame->ecx);
+    uint32_t prot = frame->edx & (PROT_READ | PROT_WRITE | PROT_EXEC);
+    if (!space || vma_protect(space, addr, size, prot) != 0) {
+        return -1;
+    }
+    paging_protect_range(addr, size / PAGE_SIZE, vma_page_flags(prot));
+    return 0;
+}
+
 static syscall_fn syscall_table[SYSCALL_MAX] = {
     [SYS_EXIT]   = sys_exit,
     [SYS_WRITE]  = sys_write,
@@ -134,6 +236,10 @@ static syscall_fn syscall_table[SYSCALL_MAX] = {
     [SYS_YIELD]  = sys_yield,
     [SYS_GETPID] = sys_getpid,
     [SYS_EXEC]   = sys_exec,
+    [SYS_FORK]   = sys_fork,
+    [SYS_MMAP]   = sys_mmap,
+    [SYS_MUNMAP] = sys_munmap,
+    [SYS_MPROTECT] = sys_mprotect,
 };
 
 static void syscall_handler(interrupt_frame_t *frame)
@@ -1,4 +1,5 @@
 #include "ui/framebuffer.h"
+#include "mem/paging.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -206,6 +207,9 @@ void framebuffer_init(multiboot_info_t *mb_info)
     if (mb_info->framebuffer_type != 1 || mb_info->framebuffer_bpp != 32) {
         return;
     }
+    if (mb_info->framebuffer_addr >> 32) {
+        return; // not reachable from 32-bit paging
+    }
     fb.hw.addr = (uint8_t *)((uintptr_t)mb_info->framebuffer_addr);
     fb.hw.width = mb_info->framebuffer_width;
     fb.hw.height = mb_info->framebuffer_height;
@@ -214,6 +218,20 @@ void framebuffer_init(multiboot_info_t *mb_info)
     fb.present = 1;
 }
 
+void framebuffer_remap(void)
+{
+    if (!fb.present) {
+        return;
+    }
+    uint32_t phys = (uint32_t)(uintptr_t)fb.hw.addr;
+    uint8_t *virt = (uint8_t *)paging_map_mmio_cached(phys, fb.hw.pitch * fb.hw.height);
+    if (!virt) {
+        fb.present = 0;
+        return;
+    }
+    fb.hw.addr = virt;
+}
+
 int framebuffer_available(void)
 {
     return fb.present;